@@ -27,10 +27,14 @@ var connectionTries = 0;
 
 var pauseAutoRefresh = false;
 var pendingGetInfo = false;
+// Set once Shelly.Subscribe succeeds, updates are pushed by the device after that.
+var subscribed = false;
 
 var pendingRequests = {};  // id -> Promise.
 
 let nextRequestID = Math.ceil(Math.random() * 10000);
+// Our address, the device uses it to send us status notifications.
+const clientID = `shellyui_${Math.ceil(Math.random() * 100000000)}`;
 let authRequired = false;
 
 const authInfoKey = "auth_info";
@@ -286,7 +290,9 @@ function rgbSetConfig(c) {
     initial_state: parseInt(el(c, "initial").value),
     auto_off: autoOff,
     in_inverted: el(c, "in_inverted").checked,
-    transition_time: parseInt(el(c, "transition_time").value)
+    transition_time: parseInt(el(c, "transition_time").value),
+    dim_rate: parseInt(el(c, "dim_rate").value),
+    curve: parseInt(el(c, "curve").value)
   };
   if (autoOff) {
     cfg.auto_off_delay = dateStringToSeconds(autoOffDelay);
@@ -564,7 +570,16 @@ function updateComponent(cd) {
       setValueIfNotModified(el(c, "name"), cd.name);
       el(c, "state").checked = cd.state;
       if (cd.apower !== undefined) {
-        el(c, "power_stats").innerText = `${Math.round(cd.apower)}W, ${cd.aenergy}Wh`;
+        var powerStats = `${Math.round(cd.apower)}W, ${cd.aenergy}Wh`;
+        // Not all meters measure everything, e.g. BL0937 without current calibration.
+        if (cd.voltage !== undefined) powerStats += `, ${Math.round(cd.voltage)}V`;
+        if (cd.current !== undefined) powerStats += `, ${cd.current.toFixed(2)}A`;
+        if (cd.rpower !== undefined) powerStats += `, ${Math.round(cd.rpower)}VAR`;
+        if (cd.pf !== undefined) powerStats += `, PF ${cd.pf.toFixed(2)}`;
+        if (cd.overpower) {
+          powerStats += ` - OVERPOWER (peak ${Math.round(cd.overpower_peak)}W)`;
+        }
+        el(c, "power_stats").innerText = powerStats;
         el(c, "power_stats_container").style.display = "block";
       }
       if (cd.svc_type !== undefined) {
@@ -618,6 +633,8 @@ function updateComponent(cd) {
         slideIfNotModified(el(c, "saturation"), cd.saturation);
         slideIfNotModified(el(c, "brightness"), cd.brightness);
         setValueIfNotModified(el(c, "transition_time"), cd.transition_time);
+        setValueIfNotModified(el(c, "dim_rate"), cd.dim_rate);
+        selectIfNotModified(el(c, "curve"), cd.curve);
         setPreviewColor(c);
       }
       break;
@@ -663,7 +680,8 @@ function updateComponent(cd) {
           el(c, "pos").innerText = cd.cur_pos;
         }
         el(c, "cal").innerText = `\
-          movement time: ${cd.move_time_ms / 1000} s, \
+          open time: ${cd.open_time_ms / 1000} s, \
+          close time: ${cd.close_time_ms / 1000} s, \
           avg power: ${cd.move_power} W`;
         el(c, "pos_ctl").style.display = "block";
       } else {
@@ -683,7 +701,7 @@ function updateComponent(cd) {
     case 5: // Garage Doot Opener
       el(c, "head").innerText = cd.name;
       setValueIfNotModified(el(c, "name"), cd.name);
-      el(c, "state").innerText = cd.cur_state_str;
+      el(c, "state").innerText = `${cd.cur_state_str} (${cd.cur_pos}%)`;
       selectIfNotModified(el(c, "close_sensor_mode"), cd.close_sensor_mode);
       setValueIfNotModified(el(c, "move_time"), cd.move_time);
       setValueIfNotModified(el(c, "pulse_time_ms"), cd.pulse_time_ms);
@@ -842,7 +860,8 @@ function updateElement(key, value, info) {
 
 function getInfo() {
   return new Promise(function (resolve, reject) {
-    let method = (infoLevel == 1 ? "Shelly.GetInfoExt" : "Shelly.GetInfo");
+    let method = "Shelly.GetInfo";
+    if (infoLevel == 1) method = (subscribed ? "Shelly.GetInfoExt" : "Shelly.Subscribe");
 
     callDevice(method).then(function (res) {
       var info = res.result;
@@ -872,6 +891,8 @@ function getInfo() {
         return;
       }
 
+      if (method == "Shelly.Subscribe") subscribed = true;
+
       lastInfo = info;
 
       el("sec_old_pass_container").style.display = (info.auth_en ? "block" : "none");
@@ -978,6 +999,10 @@ function connectWebSocket() {
 
     socket.onmessage = function(event) {
       let resp = JSON.parse(event.data);
+      if (resp.id === undefined && resp.method == "Shelly.Status") {
+        updateStatus(resp.args || resp.params);
+        return;
+      }
       let id = resp.id;
       let ri = pendingRequests[id];
       if (!ri) return;
@@ -1098,6 +1123,7 @@ function callDeviceAuth(method, params, ar) {
       console.log(`[->] ${id} ${method}`, params, ar);
       let frame = {
           "id": id,
+          "src": clientID,
           "method": method,
           "params": params,
       };
@@ -1187,7 +1213,35 @@ function onLoad() {
       console.log("getInfo() rejected", err);
     });
   });
-  setInterval(refreshUI, 1000);
+  // Uptime is not pushed, count it ourselves.
+  setInterval(function() {
+    if (lastInfo === null || lastInfo.uptime === undefined) return;
+    lastInfo.uptime++;
+    updateElement("uptime", lastInfo.uptime, lastInfo);
+  }, 1000);
+}
+
+// Applies a Shelly.Status notification: changed system fields and components.
+function updateStatus(st) {
+  if (!st || lastInfo === null || pauseAutoRefresh) return;
+  if (st.num_components !== undefined && st.num_components !== lastInfo.components.length) {
+    // Components were added or removed, get everything afresh.
+    refreshUI();
+    return;
+  }
+  for (let key in st) {
+    if (key == "num_components") continue;
+    if (key == "components") {
+      for (let cd of st.components) {
+        let i = lastInfo.components.findIndex((c) => (c.type == cd.type && c.id == cd.id));
+        if (i >= 0) lastInfo.components[i] = cd;
+        updateComponent(cd);
+      }
+      continue;
+    }
+    lastInfo[key] = st[key];
+    updateElement(key, st[key], lastInfo);
+  }
 }
 
 function refreshUI() {
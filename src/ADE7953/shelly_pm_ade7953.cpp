@@ -24,52 +24,154 @@
 
 namespace shelly {
 
-struct mgos_ade7953 *s_ade7953 = NULL;
+ADE7953Sampler::ADE7953Sampler(struct mgos_ade7953 *ade7953, int interval_ms)
+    : ade7953_(ade7953),
+      interval_ms_(interval_ms),
+      sample_timer_(std::bind(&ADE7953Sampler::SampleTimerCB, this)) {
+}
+
+ADE7953Sampler::~ADE7953Sampler() {
+}
+
+Status ADE7953Sampler::Init() {
+  if (interval_ms_ <= 0 || interval_ms_ > kSlowIntervalMs) {
+    return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s",
+                        "sample interval");
+  }
+  acc_ts_ = mgos_uptime_micros();
+  SampleTimerCB();
+  sample_timer_.Reset(GetIntervalMs(), MGOS_TIMER_REPEAT);
+  return Status::OK();
+}
+
+int ADE7953Sampler::GetIntervalMs() const {
+  return (fast_mask_ != 0 ? interval_ms_ : kSlowIntervalMs);
+}
 
-ADE7953PowerMeter::ADE7953PowerMeter(int id, struct mgos_ade7953 *ade7953,
+void ADE7953Sampler::SetFastSampling(int channel, bool fast) {
+  if (channel < 0 || channel >= kNumChannels) return;
+  uint8_t mask = fast_mask_;
+  if (fast) {
+    mask |= (1 << channel);
+  } else {
+    mask &= ~(1 << channel);
+  }
+  if (mask == fast_mask_) return;
+  bool was_fast = (fast_mask_ != 0);
+  fast_mask_ = mask;
+  if ((fast_mask_ != 0) == was_fast) return;
+  // Switching to fast, make sure readings are fresh right away.
+  if (!was_fast) SampleTimerCB();
+  sample_timer_.Reset(GetIntervalMs(), MGOS_TIMER_REPEAT);
+}
+
+void ADE7953Sampler::AddMeter(int channel, ADE7953PowerMeter *pm) {
+  if (channel < 0 || channel >= kNumChannels) return;
+  meters_[channel] = pm;
+}
+
+Status ADE7953Sampler::GetSnapshot(const Snapshot **s) const {
+  // If sampling keeps failing, don't keep serving old values.
+  if (snapshot_.ts == 0 ||
+      mgos_uptime_micros() - snapshot_.ts > 5 * GetIntervalMs() * 1000) {
+    return mgos::Errorf(STATUS_UNAVAILABLE, "No recent %s", "readings");
+  }
+  *s = &snapshot_;
+  return Status::OK();
+}
+
+void ADE7953Sampler::SampleTimerCB() {
+  int64_t now = mgos_uptime_micros();
+  // Allow for timer jitter, fast ticks don't line up exactly with slow ones.
+  int64_t slow_us = (kSlowIntervalMs - interval_ms_ / 2) * 1000;
+  bool full = (now - full_ts_ >= slow_us);
+  Snapshot s = snapshot_;
+  bool ok = (!full || mgos_ade7953_get_voltage(ade7953_, &s.voltage));
+  for (int ch = 0; ok && ch < kNumChannels; ch++) {
+    if (meters_[ch] == nullptr) continue;
+    float apa = 0, i = 0;
+    ok = mgos_ade7953_get_apower(ade7953_, ch, &apa);
+    if (ok && full) {
+      ok = mgos_ade7953_get_current(ade7953_, ch, &i);
+      s.current[ch] = std::fabs(i);
+    }
+    apa = std::fabs(apa);
+    if (apa < 1) apa = 0;  // Suppress noise.
+    s.apower[ch] = apa;
+  }
+  if (ok) {
+    s.ts = now;
+    snapshot_ = s;
+    if (full) full_ts_ = now;
+    for (int ch = 0; ch < kNumChannels; ch++) {
+      if (meters_[ch] != nullptr) meters_[ch]->CallHandlers(s.apower[ch]);
+    }
+  }
+  if (now - acc_ts_ >= slow_us) {
+    AccumulateEnergy(now);
+  }
+}
+
+void ADE7953Sampler::AccumulateEnergy(int64_t now) {
+  int elapsed_ms = (now - acc_ts_) / 1000;
+  for (int ch = 0; ch < kNumChannels; ch++) {
+    if (meters_[ch] == nullptr) continue;
+    float aea = 0;
+    if (!mgos_ade7953_get_aenergy(ade7953_, ch, true /* reset */, &aea)) {
+      continue;
+    }
+    meters_[ch]->AccumulateEnergy(std::fabs(aea), elapsed_ms);
+  }
+  acc_ts_ = now;
+}
+
+ADE7953PowerMeter::ADE7953PowerMeter(int id, ADE7953Sampler *sampler,
                                      int channel)
-    : PowerMeter(id),
-      ade7953_(ade7953),
-      channel_(channel),
-      acc_timer_(std::bind(&ADE7953PowerMeter::AEAAccumulateTimerCB, this)) {
+    : PowerMeter(id), sampler_(sampler), channel_(channel) {
 }
 
 ADE7953PowerMeter::~ADE7953PowerMeter() {
 }
 
 Status ADE7953PowerMeter::Init() {
-  acc_timer_.Reset(10000, MGOS_TIMER_REPEAT);
+  if (channel_ < 0 || channel_ >= ADE7953Sampler::kNumChannels) {
+    return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "channel");
+  }
+  sampler_->AddMeter(channel_, this);
   return Status::OK();
 }
 
 StatusOr<float> ADE7953PowerMeter::GetPowerW() {
-  float apa = 0;
-  if (!mgos_ade7953_get_apower(ade7953_, channel_, &apa)) {
-    return mgos::Errorf(STATUS_UNAVAILABLE, "Failed to read %s", "AP");
-  }
-  apa = std::fabs(apa);
-  if (apa < 1) apa = 0;  // Suppress noise.
-  return apa;
+  const ADE7953Sampler::Snapshot *s = nullptr;
+  Status st = sampler_->GetSnapshot(&s);
+  if (!st.ok()) return st;
+  return s->apower[channel_];
 }
 
-StatusOr<float> ADE7953PowerMeter::GetEnergyWH() {
-  return GetEnergyWH(false /* reset */);
+StatusOr<float> ADE7953PowerMeter::GetVoltageV() {
+  const ADE7953Sampler::Snapshot *s = nullptr;
+  Status st = sampler_->GetSnapshot(&s);
+  if (!st.ok()) return st;
+  return s->voltage;
 }
 
-StatusOr<float> ADE7953PowerMeter::GetEnergyWH(bool reset) {
-  float aea = 0;
-  if (!mgos_ade7953_get_aenergy(ade7953_, channel_, reset, &aea)) {
-    return mgos::Errorf(STATUS_UNAVAILABLE, "Failed to read %s", "AE");
-  }
-  float res = aea_acc_ + std::fabs(aea);
-  if (reset) {
-    aea_acc_ = res;
-  }
-  return res;
+StatusOr<float> ADE7953PowerMeter::GetCurrentA() {
+  const ADE7953Sampler::Snapshot *s = nullptr;
+  Status st = sampler_->GetSnapshot(&s);
+  if (!st.ok()) return st;
+  return s->current[channel_];
+}
+
+void ADE7953PowerMeter::SetFastSampling(bool fast) {
+  sampler_->SetFastSampling(channel_, fast);
 }
 
-void ADE7953PowerMeter::AEAAccumulateTimerCB() {
-  GetEnergyWH(true /* reset */);
+void ADE7953PowerMeter::AccumulateEnergy(float aea, int elapsed_ms) {
+  AddEnergyWH(aea);
+  if (elapsed_ms > 0) {
+    // Average power over the cycle, more accurate than a single reading.
+    RecordPower(aea * 3600000.0f / elapsed_ms, elapsed_ms);
+  }
 }
 
 }  // namespace shelly
@@ -24,23 +24,73 @@
 
 namespace shelly {
 
+class ADE7953PowerMeter;
+
+// Samples both channels of the chip in one go and keeps the results,
+// so meters sharing the chip don't each go to the bus on every read.
+// Everything is read once a second. While any channel needs fast sampling,
+// active power is also read in between, every interval_ms.
+class ADE7953Sampler {
+ public:
+  static constexpr int kNumChannels = 2;
+
+  struct Snapshot {
+    int64_t ts = 0;  // Time of the last successful read, 0 if none.
+    float voltage = 0;
+    float apower[kNumChannels] = {};
+    float current[kNumChannels] = {};
+  };
+
+  ADE7953Sampler(struct mgos_ade7953 *ade7953, int interval_ms);
+  ~ADE7953Sampler();
+
+  Status Init();
+
+  // Meters receive energy updates for their channel.
+  void AddMeter(int channel, ADE7953PowerMeter *pm);
+
+  // Returns the most recent snapshot, fails if it's too old.
+  Status GetSnapshot(const Snapshot **s) const;
+
+  void SetFastSampling(int channel, bool fast);
+
+ private:
+  static constexpr int kSlowIntervalMs = 1000;
+
+  int GetIntervalMs() const;
+  void SampleTimerCB();
+  void AccumulateEnergy(int64_t now);
+
+  struct mgos_ade7953 *const ade7953_;
+  const int interval_ms_;
+  Snapshot snapshot_;
+  ADE7953PowerMeter *meters_[kNumChannels] = {};
+  uint8_t fast_mask_ = 0;  // Channels that need fast sampling.
+  int64_t full_ts_ = 0;    // Time of the last full read.
+  int64_t acc_ts_ = 0;
+  mgos::Timer sample_timer_;
+
+  ADE7953Sampler(const ADE7953Sampler &other) = delete;
+};
+
 class ADE7953PowerMeter : public PowerMeter {
  public:
-  ADE7953PowerMeter(int id, struct mgos_ade7953 *ade7953, int channel);
+  ADE7953PowerMeter(int id, ADE7953Sampler *sampler, int channel);
   virtual ~ADE7953PowerMeter();
 
   Status Init() override;
   StatusOr<float> GetPowerW() override;
-  StatusOr<float> GetEnergyWH() override;
+  StatusOr<float> GetVoltageV() override;
+  StatusOr<float> GetCurrentA() override;
+  void SetFastSampling(bool fast) override;
 
  private:
-  StatusOr<float> GetEnergyWH(bool reset);
-  void AEAAccumulateTimerCB();
+  friend class ADE7953Sampler;
 
-  struct mgos_ade7953 *const ade7953_;
+  void AccumulateEnergy(float aea, int elapsed_ms);
+
+  ADE7953Sampler *const sampler_;
   const int channel_;
-  float aea_acc_ = 0;  // Accumulated active energy.
-  mgos::Timer acc_timer_;
 };
 
 }  // namespace shelly
@@ -22,6 +22,12 @@
 #include "mgos.hpp"
 #include "mgos_iram.h"
 
+#if CS_PLATFORM == CS_P_ESP8266
+extern "C" {
+#include "user_interface.h"
+}
+#endif
+
 namespace shelly {
 
 BL0937PowerMeter::BL0937PowerMeter(int id, int cf_pin, int cf1_pin, int sel_pin,
@@ -31,7 +37,8 @@ BL0937PowerMeter::BL0937PowerMeter(int id, int cf_pin, int cf1_pin, int sel_pin,
       cf1_pin_(cf1_pin),
       sel_pin_(sel_pin),
       meas_time_(meas_time),
-      meas_timer_(std::bind(&BL0937PowerMeter::MeasureTimerCB, this)) {
+      meas_timer_(std::bind(&BL0937PowerMeter::MeasureTimerCB, this)),
+      cf1_timer_(std::bind(&BL0937PowerMeter::CF1TimerCB, this)) {
 }
 
 BL0937PowerMeter::~BL0937PowerMeter() {
@@ -52,21 +59,27 @@ Status BL0937PowerMeter::Init() {
     mgos_gpio_setup_input(cf_pin_, MGOS_GPIO_PULL_NONE);
     mgos_gpio_set_int_handler_isr(cf_pin_, MGOS_GPIO_INT_EDGE_POS,
                                   &BL0937PowerMeter::GPIOIntHandler,
-                                  (void *) &cf_count_);
+                                  (void *) &cf_);
     mgos_gpio_enable_int(cf_pin_);
   }
   if (cf1_pin_ >= 0) {
     mgos_gpio_setup_input(cf1_pin_, MGOS_GPIO_PULL_NONE);
     mgos_gpio_set_int_handler_isr(cf1_pin_, MGOS_GPIO_INT_EDGE_POS,
                                   &BL0937PowerMeter::GPIOIntHandler,
-                                  (void *) &cf1_count_);
+                                  (void *) &cf1_);
     mgos_gpio_enable_int(cf1_pin_);
   }
   if (sel_pin_ >= 0) {
     mgos_gpio_setup_output(sel_pin_, 0);  // Select current measurement mode.
   }
-  meas_start_ = mgos_uptime_micros();
+  meas_start_ = last_meas_ = mgos_uptime_micros();
+  meas_start_ts_ = GetTimeUs();
   meas_timer_.Reset(meas_time_ * 1000, MGOS_TIMER_REPEAT);
+  if (cf1_pin_ >= 0) {
+    cf1_mode_ = CF1Mode::kCurrent;
+    cf1_settling_ = true;
+    cf1_timer_.Reset(kCF1SettleMs, 0);
+  }
   return Status::OK();
 }
 
@@ -74,31 +87,131 @@ StatusOr<float> BL0937PowerMeter::GetPowerW() {
   return apa_;
 }
 
-StatusOr<float> BL0937PowerMeter::GetEnergyWH() {
-  return aea_;
+StatusOr<float> BL0937PowerMeter::GetVoltageV() {
+  if (cf1_pin_ < 0 || sel_pin_ < 0 ||
+      mgos_sys_config_get_bl0937_voltage_coeff() == 0) {
+    return Status::UNIMPLEMENTED();
+  }
+  if (vrms_ < 0) {
+    return mgos::Errorf(STATUS_UNAVAILABLE, "Not measured %s", "yet");
+  }
+  return vrms_;
+}
+
+StatusOr<float> BL0937PowerMeter::GetCurrentA() {
+  if (cf1_pin_ < 0 || mgos_sys_config_get_bl0937_current_coeff() == 0) {
+    return Status::UNIMPLEMENTED();
+  }
+  if (irms_ < 0) {
+    return mgos::Errorf(STATUS_UNAVAILABLE, "Not measured %s", "yet");
+  }
+  return irms_;
+}
+
+// static
+IRAM uint32_t BL0937PowerMeter::GetTimeUs() {
+#if CS_PLATFORM == CS_P_ESP8266
+  // mgos_uptime_micros() is not ISR safe, the hardware timer is.
+  return system_get_time();
+#else
+  return (uint32_t) mgos_uptime_micros();
+#endif
 }
 
 // static
 IRAM void BL0937PowerMeter::GPIOIntHandler(int pin, void *arg) {
-  (*((uint32_t *) arg))++;
+  Pulses *p = (Pulses *) arg;
+  uint32_t now = GetTimeUs();
+  if (p->count == 0) p->first_ts = now;
+  p->last_ts = now;
+  p->count++;
   (void) pin;
 }
 
 void BL0937PowerMeter::MeasureTimerCB() {
-  uint32_t cf_count = cf_count_, cf1_count = cf1_count_;
-  float elapsed_sec = (mgos_uptime_micros() - meas_start_) / 1000000.0f;
-  if (cf_count < 2) cf_count = 0;    // Noise
-  if (cf1_count < 2) cf1_count = 0;  // Noise
-  float cfps = (cf_count / elapsed_sec), cf1ps = (cf1_count / elapsed_sec);
-  apa_ = cfps * mgos_sys_config_get_bl0937_power_coeff();  // Watts
-  aea_ += (apa_ / (3600.0f / meas_time_));                 // Watt-hours
-  LOG(LL_DEBUG, ("cfcnt %d cfps %.2f, cf1cnt %d cf1ps %.2f; apa %.2f aea %.2f",
-                 (int) cf_count, cfps, (int) cf1_count, cf1ps, apa_, aea_));
-  // Start new measurement cycle.
+  const int64_t now = mgos_uptime_micros();
+  const uint32_t now_ts = GetTimeUs();
+  const bool window_expired = (now - meas_start_ >= kMaxWindowMs * 1000LL);
+  // Take a consistent snapshot, start new cycle if we have enough edges.
   mgos_ints_disable();
-  cf_count_ = cf1_count_ = 0;
-  meas_start_ = mgos_uptime_micros();
+  const uint32_t cf_count = cf_.count;
+  const uint32_t cf_first = cf_.first_ts, cf_last = cf_.last_ts;
+  const uint32_t new_pulses = cf_count - cf_carried_;
+  const bool done = (cf_count >= 2 || window_expired);
+  if (done) {
+    if (new_pulses > 0) {
+      cf_.count = 1;
+      cf_.first_ts = cf_last;
+      cf_carried_ = 1;
+    } else {
+      cf_.count = 0;
+      cf_carried_ = 0;
+    }
+  }
+  mgos_ints_enable();
+  const float coeff = mgos_sys_config_get_bl0937_power_coeff();
+  if (cf_count >= 2) {
+    // Frequency from the period between first and last edge, this is precise
+    // even with a handful of pulses, unlike count / window.
+    uint32_t period_us = (cf_last - cf_first) / (cf_count - 1);
+    apa_ = (period_us > 0 ? coeff * 1000000.0f / period_us : 0);
+  } else if (window_expired && new_pulses == 0) {
+    apa_ = 0;
+  } else {
+    // The next edge is not here yet, power can't be more than that.
+    uint32_t since_us = now_ts - (cf_count > 0 ? cf_last : meas_start_ts_);
+    float max_apa = (since_us > 0 ? coeff * 1000000.0f / since_us : apa_);
+    if (apa_ > max_apa) apa_ = max_apa;
+  }
+  if (done) {
+    // Every pulse is a fixed quantum of energy.
+    AddEnergyWH(new_pulses * coeff / 3600.0f);  // Watt-hours
+    meas_start_ = now;
+    meas_start_ts_ = now_ts;
+  }
+  int elapsed_ms = (now - last_meas_) / 1000;
+  RecordPower(apa_, elapsed_ms);
+  CallHandlers(apa_);
+  last_meas_ = now;
+  LOG(LL_DEBUG, ("cfcnt %d%s; apa %.2f aea %u", (int) new_pulses,
+                 (done ? "" : " (ext)"), apa_, (unsigned) GetEnergyMWh()));
+}
+
+void BL0937PowerMeter::CF1TimerCB() {
+  mgos_ints_disable();
+  const uint32_t count = cf1_.count;
+  const uint32_t first = cf1_.first_ts, last = cf1_.last_ts;
+  cf1_.count = 0;
   mgos_ints_enable();
+  if (cf1_settling_) {
+    // Pulses received while settling are discarded, start measuring.
+    cf1_settling_ = false;
+    cf1_timer_.Reset(meas_time_ * 1000, 0);
+    return;
+  }
+  float freq = 0;
+  if (count >= 2 && last != first) {
+    freq = (count - 1) * 1000000.0f / (last - first);
+  }
+  if (cf1_mode_ == CF1Mode::kCurrent) {
+    irms_ = freq * mgos_sys_config_get_bl0937_current_coeff();
+  } else {
+    vrms_ = freq * mgos_sys_config_get_bl0937_voltage_coeff();
+  }
+  LOG(LL_DEBUG, ("cf1 %s cnt %d freq %.2f; vrms %.2f irms %.3f",
+                 (cf1_mode_ == CF1Mode::kCurrent ? "I" : "V"), (int) count,
+                 freq, vrms_, irms_));
+  if (sel_pin_ < 0 || mgos_sys_config_get_bl0937_voltage_coeff() == 0) {
+    // Current only.
+    cf1_timer_.Reset(meas_time_ * 1000, 0);
+    return;
+  }
+  // Switch to the other mode and let it settle.
+  cf1_mode_ = (cf1_mode_ == CF1Mode::kCurrent ? CF1Mode::kVoltage
+                                              : CF1Mode::kCurrent);
+  mgos_gpio_write(sel_pin_, (cf1_mode_ == CF1Mode::kVoltage));
+  cf1_settling_ = true;
+  cf1_timer_.Reset(kCF1SettleMs, 0);
 }
 
 }  // namespace shelly
@@ -28,21 +28,54 @@ class BL0937PowerMeter : public PowerMeter {
 
   Status Init() override;
   StatusOr<float> GetPowerW() override;
-  StatusOr<float> GetEnergyWH() override;
+  StatusOr<float> GetVoltageV() override;
+  StatusOr<float> GetCurrentA() override;
 
  private:
+  // At low load there may be fewer than two pulses per meas_time,
+  // in that case measurement window is extended, up to this long.
+  static constexpr int kMaxWindowMs = 60000;
+
+  // Updated from the ISR. Timestamps are from GetTimeUs().
+  struct Pulses {
+    volatile uint32_t count = 0;
+    volatile uint32_t first_ts = 0;
+    volatile uint32_t last_ts = 0;
+  };
+
+  // CF1 output is garbage for a while after switching the mode.
+  static constexpr int kCF1SettleMs = 200;
+
+  // CF1 measures current or voltage, depending on the SEL pin.
+  enum class CF1Mode {
+    kCurrent = 0,
+    kVoltage = 1,
+  };
+
+  // Raw 32-bit microsecond counter that is safe to read from an ISR.
+  static uint32_t GetTimeUs();
   static void GPIOIntHandler(int pin, void *arg);
   void MeasureTimerCB();
+  void CF1TimerCB();
 
   const int cf_pin_, cf1_pin_, sel_pin_, meas_time_;
 
-  volatile uint32_t cf_count_ = 0, cf1_count_ = 0;
+  Pulses cf_, cf1_;
   int64_t meas_start_ = 0;
+  uint32_t meas_start_ts_ = 0;  // Same as meas_start_, GetTimeUs() time base.
+  // Last edge of the previous window is kept as the first of the next one,
+  // so the interval spanning windows is not lost. It is not counted twice.
+  uint32_t cf_carried_ = 0;
+  int64_t last_meas_ = 0;
+  CF1Mode cf1_mode_ = CF1Mode::kCurrent;
+  bool cf1_settling_ = false;
 
-  float apa_ = 0;  // Last active power reading, W.
-  float aea_ = 0;  // Accumulated active energy, Wh.
+  float apa_ = 0;    // Last active power reading, W.
+  float vrms_ = -1;  // Last voltage reading, V. -1 if not measured yet.
+  float irms_ = -1;  // Last current reading, A. -1 if not measured yet.
 
   mgos::Timer meas_timer_;
+  mgos::Timer cf1_timer_;
 };
 
 }  // namespace shelly
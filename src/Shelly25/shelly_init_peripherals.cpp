@@ -26,6 +26,7 @@
 namespace shelly {
 
 static struct mgos_ade7953 *s_ade7953 = NULL;
+static std::unique_ptr<ADE7953Sampler> s_ade7953_sampler;
 
 static Status PowerMeterInit(std::vector<std::unique_ptr<PowerMeter>> *pms) {
   const struct mgos_config_ade7953 ade7953_cfg = {
@@ -52,10 +53,15 @@ static Status PowerMeterInit(std::vector<std::unique_ptr<PowerMeter>> *pms) {
   }
 
   Status st;
-  std::unique_ptr<PowerMeter> pm1(new ADE7953PowerMeter(1, s_ade7953, 1));
+  s_ade7953_sampler.reset(new ADE7953Sampler(
+      s_ade7953, mgos_sys_config_get_shelly_pm_sample_interval_ms()));
+  ADE7953Sampler *sampler = s_ade7953_sampler.get();
+  std::unique_ptr<PowerMeter> pm1(new ADE7953PowerMeter(1, sampler, 1));
   if (!(st = pm1->Init()).ok()) return st;
-  std::unique_ptr<PowerMeter> pm2(new ADE7953PowerMeter(2, s_ade7953, 0));
+  std::unique_ptr<PowerMeter> pm2(new ADE7953PowerMeter(2, sampler, 0));
   if (!(st = pm2->Init()).ok()) return st;
+  // Start sampling once both meters are registered.
+  if (!(st = sampler->Init()).ok()) return st;
 
   pms->emplace_back(std::move(pm1));
   pms->emplace_back(std::move(pm2));
@@ -49,6 +49,11 @@ void CreatePeripherals(std::vector<std::unique_ptr<Input>> *inputs,
   g_mock_pms.push_back(pm2.get());
   pms->emplace_back(std::move(pm2));
 
+  // Shutter motor on outputs 1 (open) and 2 (close), for WC simulation.
+  g_mock_motor = new MockMotor((*outputs)[0].get(), (*outputs)[1].get(),
+                               g_mock_pms[0], g_mock_pms[1]);
+  g_mock_motor->Init();
+
   g_mock_sys_temp_sensor = new MockTempSensor(33);
   sys_temp->reset(g_mock_sys_temp_sensor);
 
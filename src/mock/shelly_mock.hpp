@@ -19,6 +19,7 @@
 
 #include <vector>
 
+#include "shelly_mock_motor.hpp"
 #include "shelly_mock_pm.hpp"
 #include "shelly_mock_temp_sensor.hpp"
 
@@ -26,6 +27,7 @@ namespace shelly {
 
 extern std::vector<MockPowerMeter *> g_mock_pms;
 extern MockTempSensor *g_mock_sys_temp_sensor;
+extern MockMotor *g_mock_motor;
 
 void MockRPCInit();
 
@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) Shelly-HomeKit Contributors
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shelly_mock_motor.hpp"
+
+#include <cmath>
+
+#include "mgos.hpp"
+
+namespace shelly {
+
+MockMotor::MockMotor(Output *out_open, Output *out_close,
+                     MockPowerMeter *pm_open, MockPowerMeter *pm_close)
+    : out_open_(out_open),
+      out_close_(out_close),
+      pm_open_(pm_open),
+      pm_close_(pm_close),
+      step_timer_(std::bind(&MockMotor::StepTimerCB, this)) {
+}
+
+MockMotor::~MockMotor() {
+}
+
+Status MockMotor::Init() {
+  last_step_ = mgos_uptime_micros();
+  step_timer_.Reset(kStepIntervalMs, MGOS_TIMER_REPEAT);
+  return Status::OK();
+}
+
+void MockMotor::SetParams(int open_time_ms, int close_time_ms,
+                          int ramp_up_time_ms, float move_power) {
+  if (open_time_ms > 0) open_time_ms_ = open_time_ms;
+  if (close_time_ms > 0) close_time_ms_ = close_time_ms;
+  if (ramp_up_time_ms >= 0) ramp_up_time_ms_ = ramp_up_time_ms;
+  if (move_power > 0) move_power_ = move_power;
+  LOG(LL_INFO, ("Motor: ot %d ct %d rt %d p %.2f", open_time_ms_,
+                close_time_ms_, ramp_up_time_ms_, move_power_));
+}
+
+void MockMotor::SetPos(float pos) {
+  LOG(LL_INFO, ("Motor: pos %.2f -> %.2f", pos_, pos));
+  pos_ = pos;
+}
+
+void MockMotor::SetObstructionPos(float pos) {
+  obst_pos_ = pos;
+}
+
+void MockMotor::BeginReactionMeasurement() {
+  react_begin_ = mgos_uptime_micros();
+}
+
+std::string MockMotor::GetStatsJSON() const {
+  return mgos::JSONPrintStringf(
+      "{pos: %.3f, dir: %d, p: %.2f, moves: %d, "
+      "react_n: %d, react_avg_ms: %.2f, react_max_ms: %.2f}",
+      pos_, dir_, p_, num_moves_, num_reactions_,
+      (num_reactions_ > 0 ? react_total_us_ / 1000.0 / num_reactions_ : 0.0),
+      react_max_us_ / 1000.0);
+}
+
+void MockMotor::SetPower(float p) {
+  if (p == p_) return;
+  p_ = p;
+  pm_open_->SetPowerW(dir_ > 0 ? p : 0);
+  pm_close_->SetPowerW(dir_ < 0 ? p : 0);
+}
+
+void MockMotor::StepTimerCB() {
+  int64_t now = mgos_uptime_micros();
+  int64_t dt = now - last_step_;
+  last_step_ = now;
+  bool open = out_open_->GetState(), close = out_close_->GetState();
+  // Motor does not move if both windings are energized.
+  int dir = (open && !close ? 1 : (close && !open ? -1 : 0));
+  if (dir != dir_) {
+    LOG(LL_INFO, ("Motor: dir %d -> %d, pos %.2f", dir_, dir, pos_));
+    dir_ = dir;
+    dir_change_ts_ = now;
+    if (dir != 0) num_moves_++;
+    if (react_begin_ > 0) {
+      int64_t react_us = now - react_begin_;
+      react_total_us_ += react_us;
+      if (react_us > react_max_us_) react_max_us_ = react_us;
+      num_reactions_++;
+      react_begin_ = 0;
+    }
+  }
+  if (dir_ == 0) {
+    SetPower(0);
+    return;
+  }
+  // End switch cuts power.
+  if ((dir_ > 0 && pos_ >= 100) || (dir_ < 0 && pos_ <= 0)) {
+    SetPower(0);
+    return;
+  }
+  int64_t run_us = now - dir_change_ts_;
+  if (run_us < ramp_up_time_ms_ * 1000) {
+    // Ramp up in 10% steps.
+    float frac = (float) run_us / (ramp_up_time_ms_ * 1000);
+    SetPower(move_power_ * std::floor(frac * 10) / 10);
+    return;
+  }
+  if (obst_pos_ >= 0 && std::abs(pos_ - obst_pos_) < 0.5) {
+    // Stalled motor draws a lot more current.
+    SetPower(move_power_ * 3);
+    return;
+  }
+  int travel_time_ms = (dir_ > 0 ? open_time_ms_ : close_time_ms_);
+  pos_ += dir_ * (dt / 1000.0f) * 100 / travel_time_ms;
+  if (pos_ > 100) pos_ = 100;
+  if (pos_ < 0) pos_ = 0;
+  SetPower(move_power_);
+}
+
+}  // namespace shelly
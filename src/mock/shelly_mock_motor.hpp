@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) Shelly-HomeKit Contributors
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "mgos_timers.hpp"
+
+#include "shelly_mock_pm.hpp"
+#include "shelly_output.hpp"
+
+namespace shelly {
+
+// Simulates a roller shutter motor connected to a pair of outputs.
+// Power is reported through the mock power meters, movement is simulated
+// with ramp up delay, travel time in each direction and end stops that cut
+// power, as real shutter motors do.
+class MockMotor {
+ public:
+  MockMotor(Output *out_open, Output *out_close, MockPowerMeter *pm_open,
+            MockPowerMeter *pm_close);
+  ~MockMotor();
+
+  Status Init();
+
+  void SetParams(int open_time_ms, int close_time_ms, int ramp_up_time_ms,
+                 float move_power);
+  void SetPos(float pos);
+  // Motor will stall at this position, negative value to disable.
+  void SetObstructionPos(float pos);
+
+  // Marks beginning of a command, time until outputs change is recorded
+  // as reaction latency.
+  void BeginReactionMeasurement();
+
+  std::string GetStatsJSON() const;
+
+ private:
+  static constexpr int kStepIntervalMs = 10;
+
+  void StepTimerCB();
+  void SetPower(float p);
+
+  Output *const out_open_, *const out_close_;
+  MockPowerMeter *const pm_open_, *const pm_close_;
+  mgos::Timer step_timer_;
+
+  int open_time_ms_ = 20000;
+  int close_time_ms_ = 18000;
+  int ramp_up_time_ms_ = 300;
+  float move_power_ = 100;
+  float obst_pos_ = -1;
+
+  float pos_ = 0;
+  int dir_ = 0;
+  float p_ = 0;
+  int64_t last_step_ = 0;
+  int64_t dir_change_ts_ = 0;
+
+  int num_moves_ = 0;
+  int64_t react_begin_ = 0;
+  int num_reactions_ = 0;
+  int64_t react_total_us_ = 0;
+  int64_t react_max_us_ = 0;
+};
+
+}  // namespace shelly
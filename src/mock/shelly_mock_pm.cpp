@@ -36,22 +36,20 @@ StatusOr<float> MockPowerMeter::GetPowerW() {
   return apa_;
 }
 
-StatusOr<float> MockPowerMeter::GetEnergyWH() {
-  return aea_;
-}
-
 void MockPowerMeter::SetPowerW(float w) {
   LOG(LL_INFO, ("PM %d W %.2f -> %.2f", id(), apa_, w));
   apa_ = w;
 }
 
 void MockPowerMeter::SetEnergyWH(float wh) {
-  LOG(LL_INFO, ("PM %d WH %.2f -> %.2f", id(), aea_, wh));
-  aea_ = wh;
+  LOG(LL_INFO, ("PM %d WH %.2f -> %.2f", id(), GetEnergyMWh() / 1000.0, wh));
+  SetEnergyMWh(wh * 1000);
 }
 
 void MockPowerMeter::MeasureTimerCB() {
-  aea_ += (apa_ / 3600);
+  AddEnergyWH(apa_ / 3600);
+  RecordPower(apa_, 1000);
+  CallHandlers(apa_);
 }
 
 }  // namespace shelly
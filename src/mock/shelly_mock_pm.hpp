@@ -31,7 +31,6 @@ class MockPowerMeter : public PowerMeter {
   // PowerMeter interface impl.
   Status Init() override;
   StatusOr<float> GetPowerW() override;
-  StatusOr<float> GetEnergyWH() override;
 
   void SetPowerW(float w);
   void SetEnergyWH(float wh);
@@ -40,7 +39,6 @@ class MockPowerMeter : public PowerMeter {
   void MeasureTimerCB();
 
   float apa_ = 0;
-  float aea_ = 0;
   mgos::Timer meas_timer_;
 };
 
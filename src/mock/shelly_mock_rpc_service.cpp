@@ -19,8 +19,11 @@
 
 #include <cmath>
 
+#include "mgos.hpp"
 #include "mgos_rpc.h"
 
+#include "shelly_main.hpp"
+#include "shelly_mock_motor.hpp"
 #include "shelly_mock_pm.hpp"
 #include "shelly_mock_temp_sensor.hpp"
 
@@ -28,6 +31,7 @@ namespace shelly {
 
 std::vector<MockPowerMeter *> g_mock_pms;
 MockTempSensor *g_mock_sys_temp_sensor = nullptr;
+MockMotor *g_mock_motor = nullptr;
 
 static void MockSetSysTempHandler(struct mg_rpc_request_info *ri, void *cb_arg,
                                   struct mg_rpc_frame_info *fi,
@@ -66,11 +70,83 @@ static void MockSetPM(struct mg_rpc_request_info *ri, void *cb_arg,
   (void) cb_arg;
 }
 
+static void MockSetMotorHandler(struct mg_rpc_request_info *ri, void *cb_arg,
+                                struct mg_rpc_frame_info *fi,
+                                struct mg_str args) {
+  if (g_mock_motor == nullptr) {
+    mg_rpc_send_errorf(ri, 404, "no motor");
+    return;
+  }
+  int open_time_ms = -1, close_time_ms = -1, ramp_up_time_ms = -1;
+  float power = NAN, pos = NAN, obst_pos = NAN;
+  json_scanf(args.p, args.len, ri->args_fmt, &open_time_ms, &close_time_ms,
+             &ramp_up_time_ms, &power, &pos, &obst_pos);
+  g_mock_motor->SetParams(open_time_ms, close_time_ms, ramp_up_time_ms,
+                          (std::isnan(power) ? -1 : power));
+  if (!std::isnan(pos)) g_mock_motor->SetPos(pos);
+  if (!std::isnan(obst_pos)) g_mock_motor->SetObstructionPos(obst_pos);
+  mg_rpc_send_responsef(ri, nullptr);
+  (void) fi;
+  (void) cb_arg;
+}
+
+static void MockGetMotorStatsHandler(struct mg_rpc_request_info *ri,
+                                     void *cb_arg,
+                                     struct mg_rpc_frame_info *fi,
+                                     struct mg_str args) {
+  if (g_mock_motor == nullptr) {
+    mg_rpc_send_errorf(ri, 404, "no motor");
+    return;
+  }
+  std::string wc_info;
+  Component *c = FindComponent(Component::Type::kWindowCovering, 1);
+  if (c != nullptr) {
+    auto info = c->GetInfo();
+    if (info.ok()) wc_info = info.ValueOrDie();
+  }
+  const std::string &ms = g_mock_motor->GetStatsJSON();
+  mg_rpc_send_responsef(ri, "{motor: %s, wc_info: %Q, uptime: %.3f}",
+                        ms.c_str(), wc_info.c_str(), mgos_uptime());
+  (void) fi;
+  (void) cb_arg;
+  (void) args;
+}
+
+// Sets window covering target position, measuring reaction time.
+static void MockMoveWCHandler(struct mg_rpc_request_info *ri, void *cb_arg,
+                              struct mg_rpc_frame_info *fi,
+                              struct mg_str args) {
+  int id = 1, pos = -1;
+  json_scanf(args.p, args.len, ri->args_fmt, &id, &pos);
+  Component *c = FindComponent(Component::Type::kWindowCovering, id);
+  if (c == nullptr) {
+    mg_rpc_send_errorf(ri, 404, "wc %d not found", id);
+    return;
+  }
+  if (g_mock_motor != nullptr) g_mock_motor->BeginReactionMeasurement();
+  const auto &st = c->SetState(mgos::SPrintf("{tgt_pos: %d}", pos));
+  if (!st.ok()) {
+    mg_rpc_send_errorf(ri, 400, "%s", st.error_message().c_str());
+    return;
+  }
+  mg_rpc_send_responsef(ri, nullptr);
+  (void) fi;
+  (void) cb_arg;
+}
+
 void MockRPCInit() {
   mg_rpc_add_handler(mgos_rpc_get_global(), "Shelly.Mock.SetSysTemp",
                      "{temp: %f}", MockSetSysTempHandler, nullptr);
   mg_rpc_add_handler(mgos_rpc_get_global(), "Shelly.Mock.SetPM",
                      "{id: %d, w: %f, wh: %f}", MockSetPM, nullptr);
+  mg_rpc_add_handler(mgos_rpc_get_global(), "Shelly.Mock.SetMotor",
+                     "{open_time_ms: %d, close_time_ms: %d, "
+                     "ramp_up_time_ms: %d, power: %f, pos: %f, obst_pos: %f}",
+                     MockSetMotorHandler, nullptr);
+  mg_rpc_add_handler(mgos_rpc_get_global(), "Shelly.Mock.GetMotorStats", "",
+                     MockGetMotorStatsHandler, nullptr);
+  mg_rpc_add_handler(mgos_rpc_get_global(), "Shelly.Mock.MoveWC",
+                     "{id: %d, pos: %d}", MockMoveWCHandler, nullptr);
 }
 
 }  // namespace shelly
@@ -17,6 +17,8 @@
 
 #include "shelly_component.hpp"
 
+#include "mgos.hpp"
+
 namespace shelly {
 
 Component::Component(int id) : id_(id) {
@@ -33,4 +35,53 @@ bool Component::IsIdle() {
   return true;
 }
 
+Status Component::ValidateState(const std::string &state_json) const {
+  (void) state_json;
+  return Status::UNIMPLEMENTED();
+}
+
+StatusOr<std::string> Component::GetCachedInfo() {
+  if (!IsCacheValid(info_cache_)) {
+    auto is = GetInfo();
+    if (!is.ok()) return is;
+    UpdateCache(&info_cache_, is.ValueOrDie());
+  }
+  return info_cache_.value;
+}
+
+StatusOr<std::string> Component::GetCachedInfoJSON() {
+  if (!IsCacheValid(info_json_cache_)) {
+    auto is = GetInfoJSON();
+    if (!is.ok()) return is;
+    UpdateCache(&info_json_cache_, is.ValueOrDie());
+  }
+  return info_json_cache_.value;
+}
+
+uint32_t Component::info_version() const {
+  return info_version_;
+}
+
+int Component::GetInfoMaxAgeMs() const {
+  return -1;
+}
+
+void Component::InvalidateInfo() {
+  info_version_++;
+}
+
+bool Component::IsCacheValid(const InfoCache &ic) const {
+  if (!ic.valid || ic.version != info_version()) return false;
+  int max_age_ms = GetInfoMaxAgeMs();
+  if (max_age_ms < 0) return true;
+  return (mgos_uptime_micros() - ic.ts < max_age_ms * 1000);
+}
+
+void Component::UpdateCache(InfoCache *ic, const std::string &value) const {
+  ic->value = value;
+  ic->version = info_version();
+  ic->ts = mgos_uptime_micros();
+  ic->valid = true;
+}
+
 }  // namespace shelly
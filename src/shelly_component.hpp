@@ -53,11 +53,30 @@ class Component {
   virtual StatusOr<std::string> GetInfo() const = 0;
   // Full JSON status for UI.
   virtual StatusOr<std::string> GetInfoJSON() const = 0;
+
+  // Same as GetInfo() and GetInfoJSON() but reuse the previously generated
+  // string until the component invalidates it or it gets too old.
+  StatusOr<std::string> GetCachedInfo();
+  StatusOr<std::string> GetCachedInfoJSON();
+
+  // Changes every time the component invalidates its status.
+  virtual uint32_t info_version() const;
+
+  // Some status values change on their own (e.g. time since last event
+  // or power readings). This is how long cached status may be used for.
+  // Default is -1, meaning that status only changes through InvalidateInfo().
+  virtual int GetInfoMaxAgeMs() const;
   // Set configuration from UI.
   virtual Status SetConfig(const std::string &config_json,
                            bool *restart_required) = 0;
+  // Check config_json the same way SetConfig() does, without applying it.
+  virtual Status ValidateConfig(const std::string &config_json) const = 0;
   // Set state from UI.
   virtual Status SetState(const std::string &state_json) = 0;
+  // Check state_json the same way SetState() does, without applying it.
+  // Default implementation rejects everything, like SetState() of
+  // components that don't support it.
+  virtual Status ValidateState(const std::string &state_json) const;
 
   // Is there any activity going on?
   // If true is returned, it means it's ok to destroy the component.
@@ -66,8 +85,26 @@ class Component {
   // Default implementation always returns true.
   virtual bool IsIdle();
 
+ protected:
+  // Must be called when anything reported by GetInfo() or GetInfoJSON()
+  // changes, so the cached status is regenerated.
+  void InvalidateInfo();
+
  private:
+  struct InfoCache {
+    std::string value;
+    uint32_t version = 0;
+    int64_t ts = 0;
+    bool valid = false;
+  };
+
+  bool IsCacheValid(const InfoCache &ic) const;
+  void UpdateCache(InfoCache *ic, const std::string &value) const;
+
   const int id_;
+  uint32_t info_version_ = 0;
+  InfoCache info_cache_;
+  InfoCache info_json_cache_;
 
   Component(const Component &other) = delete;
 };
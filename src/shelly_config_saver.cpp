@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) Shelly-HomeKit Contributors
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shelly_config_saver.hpp"
+
+#include <algorithm>
+
+#include "mgos.hpp"
+
+namespace shelly {
+
+static ConfigSaverStats s_stats = {};
+static mgos_timer_id s_save_timer_id = MGOS_INVALID_TIMER_ID;
+// Time of the first request that has not been satisfied yet, 0 if none.
+static int64_t s_first_req = 0;
+
+static void SaveTimerCB(void *arg) {
+  s_save_timer_id = MGOS_INVALID_TIMER_ID;
+  FlushConfig();
+  (void) arg;
+}
+
+void RequestConfigSave() {
+  int64_t now = mgos_uptime_micros();
+  s_stats.num_requests++;
+  if (s_first_req == 0) s_first_req = now;
+  int64_t deadline =
+      std::min(now + mgos_sys_config_get_shelly_save_debounce_ms() * 1000LL,
+               s_first_req + mgos_sys_config_get_shelly_save_max_latency_ms() *
+                                 1000LL);
+  int delay_ms = std::max(0, (int) ((deadline - now) / 1000));
+  mgos_clear_timer(s_save_timer_id);
+  s_save_timer_id = mgos_set_timer(delay_ms, 0, SaveTimerCB, nullptr);
+}
+
+bool SaveConfig(char **msg) {
+  int64_t start = mgos_uptime_micros();
+  if (s_first_req == 0) s_first_req = start;
+  mgos_clear_timer(s_save_timer_id);
+  s_save_timer_id = MGOS_INVALID_TIMER_ID;
+  bool res = mgos_sys_config_save(&mgos_sys_config, false /* try_once */, msg);
+  int64_t end = mgos_uptime_micros();
+  s_stats.num_saves++;
+  if (!res) s_stats.num_failures++;
+  s_stats.last_delay_ms = (start - s_first_req) / 1000;
+  s_stats.max_delay_ms = std::max(s_stats.max_delay_ms, s_stats.last_delay_ms);
+  s_stats.last_write_ms = (end - start) / 1000;
+  s_stats.max_write_ms = std::max(s_stats.max_write_ms, s_stats.last_write_ms);
+  LOG(LL_DEBUG, ("Config saved: %d, delay %d ms, write %d ms", res,
+                 s_stats.last_delay_ms, s_stats.last_write_ms));
+  s_first_req = 0;
+  return res;
+}
+
+void FlushConfig() {
+  if (!IsConfigSavePending()) return;
+  SaveConfig(nullptr /* msg */);
+}
+
+bool IsConfigSavePending() {
+  return (s_first_req != 0);
+}
+
+const ConfigSaverStats &GetConfigSaverStats() {
+  return s_stats;
+}
+
+}  // namespace shelly
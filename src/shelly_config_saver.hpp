@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) Shelly-HomeKit Contributors
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+namespace shelly {
+
+// All configuration writes go through here.
+// State changes only request a save, requests are coalesced and config is
+// written once there have been no new requests for shelly.save_debounce_ms,
+// but no later than shelly.save_max_latency_ms after the first one.
+
+struct ConfigSaverStats {
+  uint32_t num_requests;
+  uint32_t num_saves;
+  uint32_t num_failures;
+  // Time from the first request to the write.
+  int last_delay_ms;
+  int max_delay_ms;
+  // Time the write itself took.
+  int last_write_ms;
+  int max_write_ms;
+};
+
+// Schedule a config save.
+void RequestConfigSave();
+
+// Save config right away, pending request is satisfied too.
+bool SaveConfig(char **msg);
+
+// If there is a pending request, save now. Used before reboot and update.
+void FlushConfig();
+
+bool IsConfigSavePending();
+
+const ConfigSaverStats &GetConfigSaverStats();
+
+}  // namespace shelly
@@ -34,6 +34,7 @@
 #include "HAPAccessoryServer+Internal.h"
 #include "HAPPlatformTCPStreamManager+Init.h"
 
+#include "shelly_config_saver.hpp"
 #include "shelly_main.hpp"
 
 namespace shelly {
@@ -82,6 +83,13 @@ void shelly_debug_write_nc(struct mg_connection *nc) {
             (unsigned) tcpm_stats.numPendingTCPStreams,
             (unsigned) tcpm_stats.numActiveTCPStreams,
             (unsigned) tcpm_stats.maxNumTCPStreams);
+  const ConfigSaverStats &css = GetConfigSaverStats();
+  mg_printf(nc,
+            "Config saves: %u/%u/%u%s, delay %d/%d ms, write %d/%d ms\r\n",
+            (unsigned) css.num_requests, (unsigned) css.num_saves,
+            (unsigned) css.num_failures,
+            (IsConfigSavePending() ? " (pending)" : ""), css.last_delay_ms,
+            css.max_delay_ms, css.last_write_ms, css.max_write_ms);
   mg_printf(nc, "HAP connections:\r\n");
   time_t now_wall = mg_time();
   int64_t now_micros = mgos_uptime_micros();
@@ -17,9 +17,14 @@
 
 #include "shelly_hap_garage_door_opener.hpp"
 
+#include <algorithm>
+#include <cmath>
+
 #include "mgos.hpp"
 #include "mgos_system.hpp"
 
+#include "shelly_config_saver.hpp"
+
 namespace shelly {
 namespace hap {
 
@@ -42,6 +47,12 @@ GarageDoorOpener::GarageDoorOpener(int id, Input *in_close, Input *in_open,
 }
 
 GarageDoorOpener::~GarageDoorOpener() {
+  if (in_close_handler_ != Input::kInvalidHandlerID) {
+    in_close_->RemoveHandler(in_close_handler_);
+  }
+  if (in_open_handler_ != Input::kInvalidHandlerID) {
+    in_open_->RemoveHandler(in_open_handler_);
+  }
   out_close_->SetState(false, "dtor");
   out_open_->SetState(false, "dtor");
 }
@@ -97,44 +108,54 @@ Status GarageDoorOpener::Init() {
   AddChar(obst_char_);
   cur_state_ = (in_close_->GetState() ? State::kClosed : State::kOpen);
   tgt_state_ = cur_state_;
+  pos_ = (cur_state_ == State::kClosed ? 0 : 100);
   LOG(LL_INFO, ("GDO %d: cur_state %d", id(), (int) cur_state_));
-  state_timer_.Reset(100, MGOS_TIMER_REPEAT);
+  // Sensors are not polled, state machine runs on input changes.
+  in_close_handler_ = in_close_->AddHandler(
+      std::bind(&GarageDoorOpener::HandleInputEvent, this, _1, _2));
+  if (in_open_ != nullptr && in_open_ != in_close_) {
+    in_open_handler_ = in_open_->AddHandler(
+        std::bind(&GarageDoorOpener::HandleInputEvent, this, _1, _2));
+  }
+  RunOnce();
   return Status::OK();
 }
 
 StatusOr<std::string> GarageDoorOpener::GetInfo() const {
   int is_closed, is_open;
   GetInputsState(&is_closed, &is_open);
-  return mgos::SPrintf("cur:%s tgt:%s cl:%d op:%d", StateStr(cur_state_),
-                       StateStr(tgt_state_), is_closed, is_open);
+  return mgos::SPrintf("cur:%s tgt:%s cl:%d op:%d pos:%d",
+                       StateStr(cur_state_), StateStr(tgt_state_), is_closed,
+                       is_open, (int) GetPos());
 }
 
 StatusOr<std::string> GarageDoorOpener::GetInfoJSON() const {
+  int tgt_pos = partial_tgt_pos_;
+  if (tgt_pos < 0) tgt_pos = (tgt_state_ == State::kOpen ? 100 : 0);
   return mgos::JSONPrintStringf(
       "{id: %d, type: %d, name: %Q, "
-      "cur_state: %d, cur_state_str: %Q, "
+      "cur_state: %d, cur_state_str: %Q, cur_pos: %d, tgt_pos: %d, "
       "move_time: %d, pulse_time_ms: %d, "
+      "open_time_ms: %d, close_time_ms: %d, "
       "close_sensor_mode: %d, open_sensor_mode: %d, "
       "out_mode: %d}",
       id(), type(), cfg_->name, (int) cur_state_, StateStr(cur_state_),
-      cfg_->move_time_ms / 1000, cfg_->pulse_time_ms, cfg_->close_sensor_mode,
-      cfg_->open_sensor_mode, (out_open_ != out_close_ ? cfg_->out_mode : -1));
+      (int) std::round(GetPos()), tgt_pos, cfg_->move_time_ms / 1000,
+      cfg_->pulse_time_ms, cfg_->open_time_ms, cfg_->close_time_ms,
+      cfg_->close_sensor_mode, cfg_->open_sensor_mode,
+      (out_open_ != out_close_ ? cfg_->out_mode : -1));
 }
 
-Status GarageDoorOpener::SetConfig(const std::string &config_json,
-                                   bool *restart_required) {
-  struct mgos_config_gdo cfg = *cfg_;
-  cfg.name = nullptr;
-  int move_time = -1, pulse_time_ms = -1, out_mode = -1;
-  int close_sensor_mode = -1, open_sensor_mode = -1;
+Status GarageDoorOpener::ValidateConfig(
+    const std::string &config_json) const {
+  char *name = nullptr;
+  int close_sensor_mode = -1, open_sensor_mode = -1, out_mode = -1;
   json_scanf(config_json.c_str(), config_json.size(),
-             "{name: %Q, move_time: %d, pulse_time_ms: %d, "
-             "close_sensor_mode: %d, open_sensor_mode: %d, out_mode: %d}",
-             &cfg.name, &move_time, &pulse_time_ms, &close_sensor_mode,
-             &open_sensor_mode, &out_mode);
-  mgos::ScopedCPtr name_owner((void *) cfg.name);
-  // Validate.
-  if (cfg.name != nullptr && strlen(cfg.name) > 64) {
+             "{name: %Q, close_sensor_mode: %d, open_sensor_mode: %d, "
+             "out_mode: %d}",
+             &name, &close_sensor_mode, &open_sensor_mode, &out_mode);
+  mgos::ScopedCPtr name_owner(name);
+  if (name != nullptr && strlen(name) > 64) {
     return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s",
                         "name (too long, max 64)");
   }
@@ -150,6 +171,25 @@ Status GarageDoorOpener::SetConfig(const std::string &config_json,
     return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "out_mode");
   }
   // We don't impose a limit on pulse time.
+  return Status::OK();
+}
+
+Status GarageDoorOpener::SetConfig(const std::string &config_json,
+                                   bool *restart_required) {
+  Status st = ValidateConfig(config_json);
+  if (!st.ok()) return st;
+  struct mgos_config_gdo cfg = *cfg_;
+  cfg.name = nullptr;
+  int move_time = -1, pulse_time_ms = -1, out_mode = -1;
+  int close_sensor_mode = -1, open_sensor_mode = -1;
+  int open_time_ms = -1, close_time_ms = -1;
+  json_scanf(config_json.c_str(), config_json.size(),
+             "{name: %Q, move_time: %d, pulse_time_ms: %d, "
+             "close_sensor_mode: %d, open_sensor_mode: %d, out_mode: %d, "
+             "open_time_ms: %d, close_time_ms: %d}",
+             &cfg.name, &move_time, &pulse_time_ms, &close_sensor_mode,
+             &open_sensor_mode, &out_mode, &open_time_ms, &close_time_ms);
+  mgos::ScopedCPtr name_owner((void *) cfg.name);
   // Apply.
   if (cfg.name != nullptr && strcmp(cfg_->name, cfg.name) != 0) {
     mgos_conf_set_str(&cfg_->name, cfg.name);
@@ -171,12 +211,61 @@ Status GarageDoorOpener::SetConfig(const std::string &config_json,
     cfg_->out_mode = out_mode;
     *restart_required = true;
   }
+  // Setting to 0 makes it re-learn.
+  if (open_time_ms >= 0) {
+    cfg_->open_time_ms = open_time_ms;
+  }
+  if (close_time_ms >= 0) {
+    cfg_->close_time_ms = close_time_ms;
+  }
+  InvalidateInfo();
+  // Sensor modes and timing may have changed.
+  RunOnce();
+  return Status::OK();
+}
+
+Status GarageDoorOpener::ValidateState(const std::string &state_json) const {
+  int tgt_pos = -1;
+  json_scanf(state_json.c_str(), state_json.size(), "{tgt_pos: %d}",
+             &tgt_pos);
+  if (tgt_pos == -1) return Status::OK();
+  // Partial opening: start opening and stop once the position is reached.
+  // Only the opening direction is supported, on most openers a pulse
+  // while closing reverses instead of stopping.
+  if (tgt_pos <= 0 || tgt_pos >= 100) {
+    return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "tgt_pos");
+  }
+  // With separate open and close outputs there is no way to stop,
+  // a pulse on the close output reverses the door.
+  if (cfg_->out_mode == 1) {
+    return mgos::Errorf(STATUS_FAILED_PRECONDITION,
+                        "%s is not supported with separate outputs",
+                        "tgt_pos");
+  }
+  bool will_open = (cur_state_ == State::kClosed ||
+                    (cur_state_ == State::kStopped &&
+                     pre_stopped_state_ != State::kOpening));
+  if (!will_open || tgt_pos <= GetPos()) {
+    return mgos::Errorf(STATUS_FAILED_PRECONDITION,
+                        "door must be stopped below %d%%", tgt_pos);
+  }
   return Status::OK();
 }
 
 Status GarageDoorOpener::SetState(const std::string &state_json) {
+  Status st = ValidateState(state_json);
+  if (!st.ok()) return st;
   int8_t toggle = -1;
-  json_scanf(state_json.c_str(), state_json.size(), "{toggle: %B}", &toggle);
+  int tgt_pos = -1;
+  json_scanf(state_json.c_str(), state_json.size(),
+             "{toggle: %B, tgt_pos: %d}", &toggle, &tgt_pos);
+  if (tgt_pos != -1) {
+    ToggleState("RPC");
+    partial_tgt_pos_ = tgt_pos;
+    InvalidateInfo();
+    RunOnce();
+    return Status::OK();
+  }
   if (toggle != -1 && toggle) {
     ToggleState("RPC");
     RunOnce();
@@ -188,6 +277,15 @@ bool GarageDoorOpener::IsIdle() {
   return (cur_state_ != State::kOpening && cur_state_ != State::kClosing);
 }
 
+int GarageDoorOpener::GetInfoMaxAgeMs() const {
+  // Sensor input changes invalidate info, position needs refreshing
+  // while moving.
+  if (cur_state_ == State::kOpening || cur_state_ == State::kClosing) {
+    return 1000;
+  }
+  return -1;
+}
+
 // static
 const char *GarageDoorOpener::StateStr(State state) {
   switch (state) {
@@ -233,8 +331,25 @@ void GarageDoorOpener::SetCurState(State new_state) {
     pre_stopped_state_ = cur_state_;
     obst_notify = true;
   }
+  pos_ = GetPos();
+  switch (new_state) {
+    case State::kOpen:
+      pos_ = 100;
+      break;
+    case State::kClosed:
+      pos_ = 0;
+      break;
+    case State::kOpening:
+    case State::kClosing:
+      move_start_pos_ = pos_;
+      break;
+    case State::kStopped:
+      break;
+  }
+  if (new_state != State::kOpening) partial_tgt_pos_ = -1;
   cur_state_ = new_state;
   begin_ = mgos_uptime_micros();
+  InvalidateInfo();
   cur_state_char_->RaiseEvent();
   if (obst_notify) {
     obst_char_->RaiseEvent();
@@ -309,12 +424,83 @@ void GarageDoorOpener::SetTgtState(State new_state, const char *src) {
                   (int) new_state, src));
   }
   tgt_state_ = new_state;
+  InvalidateInfo();
   // Always notify, even if not changed, to make sure HAP is in sync with
   // reality that may be different from what it thinks it is.
   tgt_state_char_->RaiseEvent();
 }
 
+int GarageDoorOpener::GetTravelTimeMs(bool opening) const {
+  int travel_time_ms = (opening ? cfg_->open_time_ms : cfg_->close_time_ms);
+  if (travel_time_ms <= 0) travel_time_ms = cfg_->move_time_ms;
+  return std::max(travel_time_ms, 1);
+}
+
+float GarageDoorOpener::GetPos() const {
+  bool opening = (cur_state_ == State::kOpening);
+  if (!opening && cur_state_ != State::kClosing) return pos_;
+  int64_t elapsed_ms = (mgos_uptime_micros() - begin_) / 1000;
+  float dist = elapsed_ms * 100.0f / GetTravelTimeMs(opening);
+  // End positions are only reported when confirmed.
+  if (opening) return std::min(move_start_pos_ + dist, 99.0f);
+  return std::max(move_start_pos_ - dist, 1.0f);
+}
+
+void GarageDoorOpener::LearnTravelTime(bool opening, int travel_time_ms) {
+  if (travel_time_ms <= cfg_->begin_move_time_ms ||
+      travel_time_ms > cfg_->move_time_ms) {
+    return;
+  }
+  int *cfg_time_ms = (opening ? &cfg_->open_time_ms : &cfg_->close_time_ms);
+  // Travel time jitters, only save significant changes.
+  if (std::abs(*cfg_time_ms - travel_time_ms) < travel_time_ms / 20) return;
+  LOG(LL_INFO, ("GDO %d: %s time %d -> %d", id(),
+                (opening ? "open" : "close"), *cfg_time_ms, travel_time_ms));
+  *cfg_time_ms = travel_time_ms;
+  RequestConfigSave();
+  InvalidateInfo();
+}
+
+void GarageDoorOpener::HandleInputEvent(Input::Event ev, bool state) {
+  if (ev != Input::Event::kChange) return;
+  // Sensor state is part of the info.
+  InvalidateInfo();
+  RunOnce();
+  (void) state;
+}
+
 void GarageDoorOpener::RunOnce() {
+  RunStateMachine();
+  int delay_ms = GetNextRunDelayMs();
+  if (delay_ms < 0) {
+    state_timer_.Clear();
+  } else {
+    state_timer_.Reset(delay_ms, 0);
+  }
+}
+
+int GarageDoorOpener::GetNextRunDelayMs() const {
+  if (cur_state_ != State::kOpening && cur_state_ != State::kClosing) {
+    return -1;
+  }
+  // While moving, wake up exactly when the next deadline expires.
+  int elapsed_ms = (mgos_uptime_micros() - begin_) / 1000;
+  int deadline_ms = cfg_->move_time_ms;
+  if (elapsed_ms <= cfg_->begin_move_time_ms) {
+    deadline_ms = cfg_->begin_move_time_ms;
+  }
+  int delay_ms = -1;
+  if (elapsed_ms <= deadline_ms) delay_ms = deadline_ms - elapsed_ms + 1;
+  if (cur_state_ == State::kOpening && partial_tgt_pos_ >= 0) {
+    int stop_ms = (partial_tgt_pos_ - move_start_pos_) * GetTravelTimeMs(true) /
+                  100;
+    int stop_delay_ms = std::max(stop_ms - elapsed_ms + 1, 0);
+    if (delay_ms < 0 || stop_delay_ms < delay_ms) delay_ms = stop_delay_ms;
+  }
+  return delay_ms;
+}
+
+void GarageDoorOpener::RunStateMachine() {
   int is_closed, is_open;
   GetInputsState(&is_closed, &is_open);
   LOG(LL_DEBUG,
@@ -348,6 +534,9 @@ void GarageDoorOpener::RunOnce() {
       int64_t elapsed_ms = (mgos_uptime_micros() - begin_) / 1000;
       if (is_open != -1) {
         if (is_open) {
+          if (move_start_pos_ == 0 && partial_tgt_pos_ < 0) {
+            LearnTravelTime(true /* opening */, elapsed_ms);
+          }
           SetCurState(State::kOpen);
           break;
         }
@@ -365,15 +554,24 @@ void GarageDoorOpener::RunOnce() {
       if (is_closed && elapsed_ms > cfg_->begin_move_time_ms) {
         SetTgtState(State::kClosed, "ext");
         SetCurState(State::kClosed);
+        break;
+      }
+      if (partial_tgt_pos_ >= 0 && GetPos() >= partial_tgt_pos_) {
+        LOG(LL_INFO, ("GDO %d: Reached %d%%, stopping", id(),
+                      partial_tgt_pos_));
+        ToggleState("partial");
       }
       break;
     }
     case State::kClosing: {
+      int64_t elapsed_ms = (mgos_uptime_micros() - begin_) / 1000;
       if (is_closed) {
+        if (move_start_pos_ == 100) {
+          LearnTravelTime(false /* opening */, elapsed_ms);
+        }
         SetCurState(State::kClosed);
         break;
       }
-      int64_t elapsed_ms = (mgos_uptime_micros() - begin_) / 1000;
       if (elapsed_ms > cfg_->move_time_ms) {
         obstruction_detected_ = true;
         SetCurState(State::kStopped);
@@ -48,8 +48,11 @@ class GarageDoorOpener : public Component, public mgos::hap::Service {
   StatusOr<std::string> GetInfoJSON() const override;
   Status SetConfig(const std::string &config_json,
                    bool *restart_required) override;
+  Status ValidateConfig(const std::string &config_json) const override;
   Status SetState(const std::string &state_json) override;
+  Status ValidateState(const std::string &state_json) const override;
   bool IsIdle() override;
+  int GetInfoMaxAgeMs() const override;
 
  private:
   // NB: Values correspond to HAP Current Door State values.
@@ -71,12 +74,26 @@ class GarageDoorOpener : public Component, public mgos::hap::Service {
                             const HAPUInt8CharacteristicWriteRequest *req,
                             uint8_t value);
 
+  void HandleInputEvent(Input::Event ev, bool state);
+
+  // Position is estimated from time, 0 - closed, 100 - open.
+  int GetTravelTimeMs(bool opening) const;
+  float GetPos() const;
+  void LearnTravelTime(bool opening, int travel_time_ms);
+
+  // Runs the state machine and schedules the next run.
   void RunOnce();
+  void RunStateMachine();
+  // Returns -1 if there is nothing to wait for but sensor events.
+  int GetNextRunDelayMs() const;
 
   Input *in_close_, *in_open_;
   Output *out_close_, *out_open_;
   struct mgos_config_gdo *cfg_;
 
+  Input::HandlerID in_close_handler_ = Input::kInvalidHandlerID;
+  Input::HandlerID in_open_handler_ = Input::kInvalidHandlerID;
+
   mgos::Timer state_timer_;
 
   mgos::hap::Characteristic *cur_state_char_ = nullptr;
@@ -88,6 +105,9 @@ class GarageDoorOpener : public Component, public mgos::hap::Service {
   State pre_stopped_state_;
   int64_t begin_ = 0;
   bool obstruction_detected_ = false;
+  float pos_ = 0;             // Position at the time of last state change.
+  float move_start_pos_ = 0;  // Position when movement began.
+  int partial_tgt_pos_ = -1;  // Stop when this position is reached.
 };
 
 }  // namespace hap
@@ -65,6 +65,11 @@ class ShellyDisabledInput : public Component, public mgos::hap::Service {
     return Status::OK();
   }
 
+  Status ValidateConfig(const std::string &config_json) const override {
+    (void) config_json;
+    return Status::OK();
+  }
+
   Status SetState(const std::string &state_json) override {
     (void) state_json;
     return Status::UNIMPLEMENTED();
@@ -165,16 +170,26 @@ StatusOr<std::string> ShellyInput::GetInfoJSON() const {
                                 si.c_str(), cfg_->inverted);
 }
 
+Status ShellyInput::ValidateConfig(const std::string &config_json) const {
+  int new_type = -2;
+  json_scanf(config_json.c_str(), config_json.size(), "{type: %d}",
+             &new_type);
+  if (new_type != -2 && new_type != (int) initial_type_ &&
+      !IsValidType(new_type)) {
+    return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "type");
+  }
+  return c_->ValidateConfig(config_json);
+}
+
 Status ShellyInput::SetConfig(const std::string &config_json,
                               bool *restart_required) {
+  Status st = ValidateConfig(config_json);
+  if (!st.ok()) return st;
   int new_type = -2;
   int8_t inverted = -1;
   json_scanf(config_json.c_str(), config_json.size(),
              "{type: %d, inverted: %B}", &new_type, &inverted);
   if (new_type != -2 && new_type != (int) initial_type_) {
-    if (!IsValidType(new_type)) {
-      return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "type");
-    }
     cfg_->type = new_type;
     *restart_required = true;
   }
@@ -182,6 +197,7 @@ Status ShellyInput::SetConfig(const std::string &config_json,
     cfg_->inverted = inverted;
     *restart_required = true;
   }
+  InvalidateInfo();
   // Service may have changed but we still call SetConfig for the current one.
   return c_->SetConfig(config_json, restart_required);
 }
@@ -191,6 +207,15 @@ Status ShellyInput::SetState(const std::string &state_json) {
   return Status::UNIMPLEMENTED();
 }
 
+uint32_t ShellyInput::info_version() const {
+  // Our status includes that of the wrapped component.
+  return Component::info_version() + c_->info_version();
+}
+
+int ShellyInput::GetInfoMaxAgeMs() const {
+  return c_->GetInfoMaxAgeMs();
+}
+
 uint16_t ShellyInput::GetAIDBase() const {
   switch (initial_type_) {
     case Type::kDisabledInput:
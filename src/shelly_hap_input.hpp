@@ -46,7 +46,10 @@ class ShellyInput : public Component {
   StatusOr<std::string> GetInfoJSON() const override;
   Status SetConfig(const std::string &config_json,
                    bool *restart_required) override;
+  Status ValidateConfig(const std::string &config_json) const override;
   Status SetState(const std::string &state_json) override;
+  uint32_t info_version() const override;
+  int GetInfoMaxAgeMs() const override;
 
   uint16_t GetAIDBase() const;
   mgos::hap::Service *GetService() const;
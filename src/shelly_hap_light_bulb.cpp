@@ -17,6 +17,7 @@
 
 #include "shelly_hap_light_bulb.hpp"
 #include "shelly_main.hpp"
+#include "shelly_state_journal.hpp"
 #include "shelly_switch.hpp"
 
 #include "mgos.hpp"
@@ -47,9 +48,8 @@ LightBulb::LightBulb(int id, Input *in, Output *out_r, Output *out_g,
 LightBulb::~LightBulb() {
   if (in_ != nullptr) {
     in_->RemoveHandler(handler_id_);
+    in_->SetHoldRepeatMs(0);
   }
-
-  SaveState();
 }
 
 Component::Type LightBulb::type() const {
@@ -107,8 +107,11 @@ Status LightBulb::Init() {
     handler_id_ =
         in_->AddHandler(std::bind(&LightBulb::InputEventHandler, this, _1, _2));
     in_->SetInvert(cfg_->in_inverted);
+    UpdateHoldRepeat();
   }
 
+  RestoreState();
+
   bool should_restore = (cfg_->initial_state == (int) InitialState::kLast);
   if (IsSoftReboot()) should_restore = true;
 
@@ -137,71 +140,33 @@ Status LightBulb::Init() {
   return Status::OK();
 }
 
-void LightBulb::HSVtoRGBW(RGBW &rgbw) const {
-  float h = cfg_->hue / 360.0f;
-  float s = cfg_->saturation / 100.0f;
-  float v = cfg_->brightness / 100.0f;
-
-  if (cfg_->saturation == 0) {
-    // if saturation is zero than all rgb channels same as brightness
-    rgbw.r = rgbw.g = rgbw.b = v;
-  } else {
-    // otherwise calc rgb from hsv (hue, saturation, brightness)
-    int i = static_cast<int>(h * 6);
-    float f = (h * 6.0f - i);
-    float p = v * (1.0f - s);
-    float q = v * (1.0f - f * s);
-    float t = v * (1.0f - (1.0f - f) * s);
-
-    switch (i % 6) {
-      case 0:  // 0° ≤ h < 60°
-        rgbw.r = v;
-        rgbw.g = t;
-        rgbw.b = p;
-        break;
-
-      case 1:  // 60° ≤ h < 120°
-        rgbw.r = q;
-        rgbw.g = v;
-        rgbw.b = p;
-        break;
-
-      case 2:  // 120° ≤ h < 180°
-        rgbw.r = p;
-        rgbw.g = v;
-        rgbw.b = t;
-        break;
-
-      case 3:  // 180° ≤ h < 240°
-        rgbw.r = p;
-        rgbw.g = q;
-        rgbw.b = v;
-        break;
-
-      case 4:  // 240° ≤ h < 300°
-        rgbw.r = t;
-        rgbw.g = p;
-        rgbw.b = v;
-        break;
-
-      case 5:  // 300° ≤ h < 360°
-        rgbw.r = v;
-        rgbw.g = p;
-        rgbw.b = q;
-        break;
-    }
+void LightBulb::RestoreState() {
+  int32_t v;
+  if (StateJournalGet(Type::kLightBulb, id(), StateKey::kOn, &v)) {
+    cfg_->state = v;
   }
-
-  if (out_w_ != nullptr) {
-    // apply white channel to rgb if available
-    rgbw.w = std::min(rgbw.r, std::min(rgbw.g, rgbw.b));
-    rgbw.r = rgbw.r - rgbw.w;
-    rgbw.g = rgbw.g - rgbw.w;
-    rgbw.b = rgbw.b - rgbw.w;
-  } else {
-    // otherwise turn white channel off
-    rgbw.w = 0.0f;
+  if (StateJournalGet(Type::kLightBulb, id(), StateKey::kBrightness, &v)) {
+    cfg_->brightness = v;
+  }
+  if (StateJournalGet(Type::kLightBulb, id(), StateKey::kHue, &v)) {
+    cfg_->hue = v;
   }
+  if (StateJournalGet(Type::kLightBulb, id(), StateKey::kSaturation, &v)) {
+    cfg_->saturation = v;
+  }
+}
+
+static void SetOutputLevel(Output *out, LightCurve curve, LightLevel level) {
+  // Outputs are linear, correct for perceived brightness.
+  level = ApplyLightCurve(curve, level);
+  out->SetStatePWM(level * (1.0f / kLightLevelMax), "transition");
+}
+
+// Number of distinct output values between two levels.
+static int GetVisibleSteps(Output *out, LightCurve curve, LightLevel from,
+                           LightLevel to) {
+  int a = ApplyLightCurve(curve, from), b = ApplyLightCurve(curve, to);
+  return (std::abs(b - a) * out->GetPWMSteps()) / kLightLevelMax;
 }
 
 void LightBulb::UpdateOnOff(bool on, const std::string &source, bool force) {
@@ -211,7 +176,8 @@ void LightBulb::UpdateOnOff(bool on, const std::string &source, bool force) {
                 OnOff(cfg_->state), OnOff(on)));
 
   cfg_->state = on;
-  dirty_ = true;
+  StateJournalPut(Type::kLightBulb, id(), StateKey::kOn, on);
+  InvalidateInfo();
   on_characteristic->RaiseEvent();
 
   if (IsOff()) {
@@ -227,7 +193,8 @@ void LightBulb::SetHue(int hue, const std::string &source) {
   LOG(LL_INFO, ("Hue changed (%s): %d => %d", source.c_str(), cfg_->hue, hue));
 
   cfg_->hue = hue;
-  dirty_ = true;
+  StateJournalPut(Type::kLightBulb, id(), StateKey::kHue, hue);
+  InvalidateInfo();
   hue_characteristic->RaiseEvent();
 
   StartTransition();
@@ -240,7 +207,8 @@ void LightBulb::SetSaturation(int saturation, const std::string &source) {
                 cfg_->saturation, saturation));
 
   cfg_->saturation = saturation;
-  dirty_ = true;
+  StateJournalPut(Type::kLightBulb, id(), StateKey::kSaturation, saturation);
+  InvalidateInfo();
   saturation_characteristic->RaiseEvent();
 
   StartTransition();
@@ -253,37 +221,61 @@ void LightBulb::SetBrightness(int brightness, const std::string &source) {
                 cfg_->brightness, brightness));
 
   cfg_->brightness = brightness;
-  dirty_ = true;
+  StateJournalPut(Type::kLightBulb, id(), StateKey::kBrightness, brightness);
+  InvalidateInfo();
   brightness_characteristic->RaiseEvent();
 
   StartTransition();
 }
 
-void LightBulb::StartTransition() {
+void LightBulb::StartTransition(int duration_ms) {
   rgbw_start_ = rgbw_now_;
+  transition_time_ms_ =
+      (duration_ms >= 0 ? duration_ms : cfg_->transition_time);
 
   if (IsOn()) {
-    ResetAutoOff();
-    HSVtoRGBW(rgbw_end_);
+    // Dimming is a long press, which disables auto off.
+    if (!dimming_) ResetAutoOff();
+    rgbw_end_ = HSVToRGBW(cfg_->hue, cfg_->saturation, cfg_->brightness,
+                          out_w_ != nullptr);
   } else {
     // turn off
-    rgbw_end_.r = rgbw_end_.g = rgbw_end_.b = rgbw_end_.w = 0.0f;
+    rgbw_end_.r = rgbw_end_.g = rgbw_end_.b = rgbw_end_.w = 0;
   }
 
-  LOG(LL_INFO, ("Transition started... %d [ms]", cfg_->transition_time));
+  int tick_ms = GetTransitionTickMs();
 
-  LOG(LL_INFO, ("Output 1: %.2f => %.2f", rgbw_start_.r, rgbw_end_.r));
-  LOG(LL_INFO, ("Output 2: %.2f => %.2f", rgbw_start_.g, rgbw_end_.g));
-  LOG(LL_INFO, ("Output 3: %.2f => %.2f", rgbw_start_.b, rgbw_end_.b));
-  LOG(LL_INFO, ("Output 4: %.2f => %.2f", rgbw_start_.w, rgbw_end_.w));
+  // Dimming starts a transition with every step, keep the log readable.
+  LOG((dimming_ ? LL_DEBUG : LL_INFO),
+      ("Transition started... %d [ms] tick %d, %d/%d/%d/%d => %d/%d/%d/%d",
+       transition_time_ms_, tick_ms, rgbw_start_.r, rgbw_start_.g,
+       rgbw_start_.b, rgbw_start_.w, rgbw_end_.r, rgbw_end_.g, rgbw_end_.b,
+       rgbw_end_.w));
 
   // restarting transition timer to fade
   transition_start_ = mgos_uptime_micros();
-  transition_timer_.Reset(10, MGOS_TIMER_REPEAT);
+  transition_timer_.Reset(tick_ms, MGOS_TIMER_REPEAT);
+}
+
+int LightBulb::GetTransitionTickMs() const {
+  LightCurve curve = static_cast<LightCurve>(cfg_->curve);
+  int steps = GetVisibleSteps(out_r_, curve, rgbw_start_.r, rgbw_end_.r);
+  steps = std::max(
+      steps, GetVisibleSteps(out_g_, curve, rgbw_start_.g, rgbw_end_.g));
+  steps = std::max(
+      steps, GetVisibleSteps(out_b_, curve, rgbw_start_.b, rgbw_end_.b));
+  if (out_w_ != nullptr) {
+    steps = std::max(
+        steps, GetVisibleSteps(out_w_, curve, rgbw_start_.w, rgbw_end_.w));
+  }
+  // No point in updating more often than output can change.
+  int tick_ms = (steps > 0 ? transition_time_ms_ / steps : transition_time_ms_);
+  if (tick_ms < kMinTransitionTickMs) tick_ms = kMinTransitionTickMs;
+  if (tick_ms > kMaxTransitionTickMs) tick_ms = kMaxTransitionTickMs;
+  return tick_ms;
 }
 
 StatusOr<std::string> LightBulb::GetInfo() const {
-  const_cast<LightBulb *>(this)->SaveState();
   return mgos::SPrintf("sta: %s, b: %i, h: %i, sa: %i", OnOff(IsOn()),
                        cfg_->brightness, cfg_->hue, cfg_->saturation);
 }
@@ -293,44 +285,72 @@ StatusOr<std::string> LightBulb::GetInfoJSON() const {
       "{id: %d, type: %d, name: %Q, state: %B, "
       " brightness: %d, hue: %d, saturation: %d, "
       " in_inverted: %B, initial: %d, in_mode: %d, "
-      "auto_off: %B, auto_off_delay: %.3f, transition_time: %d}",
+      "auto_off: %B, auto_off_delay: %.3f, transition_time: %d, "
+      "dim_rate: %d, curve: %d}",
       id(), type(), cfg_->name, cfg_->state, cfg_->brightness, cfg_->hue,
       cfg_->saturation, cfg_->in_inverted, cfg_->initial_state, cfg_->in_mode,
-      cfg_->auto_off, cfg_->auto_off_delay, cfg_->transition_time);
+      cfg_->auto_off, cfg_->auto_off_delay, cfg_->transition_time,
+      cfg_->dim_rate, cfg_->curve);
 }
 
-Status LightBulb::SetConfig(const std::string &config_json,
-                            bool *restart_required) {
-  struct mgos_config_lb cfg = *cfg_;
-  int8_t in_inverted = -1;
-  cfg.name = nullptr;
-  cfg.in_mode = -2;
+Status LightBulb::ParseConfig(const std::string &config_json,
+                              struct mgos_config_lb *cfg,
+                              int8_t *in_inverted) const {
+  *cfg = *cfg_;
+  cfg->name = nullptr;
+  cfg->in_mode = -2;
   json_scanf(config_json.c_str(), config_json.size(),
              "{name: %Q, in_mode: %d, in_inverted: %B, "
              "initial_state: %d, "
-             "auto_off: %B, auto_off_delay: %lf, transition_time: %d}",
-             &cfg.name, &cfg.in_mode, &in_inverted, &cfg.initial_state,
-             &cfg.auto_off, &cfg.auto_off_delay, &cfg.transition_time);
-
-  mgos::ScopedCPtr name_owner((void *) cfg.name);
+             "auto_off: %B, auto_off_delay: %lf, transition_time: %d, "
+             "dim_rate: %d, curve: %d}",
+             &cfg->name, &cfg->in_mode, in_inverted, &cfg->initial_state,
+             &cfg->auto_off, &cfg->auto_off_delay, &cfg->transition_time,
+             &cfg->dim_rate, &cfg->curve);
   // Validation.
-  if (cfg.name != nullptr && strlen(cfg.name) > 64) {
+  if (cfg->name != nullptr && strlen(cfg->name) > 64) {
     return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s",
                         "name (too long, max 64)");
   }
-  if (cfg.in_mode != -2 &&
-      (cfg.in_mode < 0 || cfg.in_mode >= (int) InMode::kMax)) {
+  if (cfg->in_mode != -2 &&
+      (cfg->in_mode < 0 || cfg->in_mode >= (int) InMode::kMax)) {
     return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "in_mode");
   }
-  if (cfg.initial_state < 0 || cfg.initial_state >= (int) InitialState::kMax ||
+  if (cfg->initial_state < 0 ||
+      cfg->initial_state >= (int) InitialState::kMax ||
       (cfg_->in_mode == -1 &&
-       cfg.initial_state == (int) InitialState::kInput)) {
+       cfg->initial_state == (int) InitialState::kInput)) {
     return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "initial_state");
   }
-  cfg.auto_off = (cfg.auto_off != 0);
-  if (cfg.initial_state < 0 || cfg.initial_state > (int) InitialState::kMax) {
+  cfg->auto_off = (cfg->auto_off != 0);
+  if (cfg->initial_state < 0 ||
+      cfg->initial_state > (int) InitialState::kMax) {
     return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "initial_state");
   }
+  if (cfg->dim_rate < 0 || cfg->dim_rate > 100) {
+    return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "dim_rate");
+  }
+  if (cfg->curve < 0 || cfg->curve >= (int) LightCurve::kMax) {
+    return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "curve");
+  }
+  return Status::OK();
+}
+
+Status LightBulb::ValidateConfig(const std::string &config_json) const {
+  struct mgos_config_lb cfg;
+  int8_t in_inverted = -1;
+  Status st = ParseConfig(config_json, &cfg, &in_inverted);
+  mgos::ScopedCPtr name_owner((void *) cfg.name);
+  return st;
+}
+
+Status LightBulb::SetConfig(const std::string &config_json,
+                            bool *restart_required) {
+  struct mgos_config_lb cfg;
+  int8_t in_inverted = -1;
+  Status st = ParseConfig(config_json, &cfg, &in_inverted);
+  mgos::ScopedCPtr name_owner((void *) cfg.name);
+  if (!st.ok()) return st;
   // Now copy over.
   if (cfg_->name != nullptr && strcmp(cfg_->name, cfg.name) != 0) {
     mgos_conf_set_str(&cfg_->name, cfg.name);
@@ -351,22 +371,19 @@ Status LightBulb::SetConfig(const std::string &config_json,
   cfg_->auto_off = cfg.auto_off;
   cfg_->auto_off_delay = cfg.auto_off_delay;
   cfg_->transition_time = cfg.transition_time;
+  cfg_->dim_rate = cfg.dim_rate;
+  cfg_->curve = cfg.curve;
+  UpdateHoldRepeat();
+  InvalidateInfo();
   return Status::OK();
 }
 
-void LightBulb::SaveState() {
-  if (!dirty_) return;
-  mgos_sys_config_save(&mgos_sys_config, false /* try_once */, NULL /* msg */);
-  dirty_ = false;
-}
-
-Status LightBulb::SetState(const std::string &state_json) {
-  int8_t state = -1;
+Status LightBulb::ValidateState(const std::string &state_json) const {
   int brightness = -1, hue = -1, saturation = -1;
 
   json_scanf(state_json.c_str(), state_json.size(),
-             "{state: %B, brightness: %d, hue: %d, saturation: %d}", &state,
-             &brightness, &hue, &saturation);
+             "{brightness: %d, hue: %d, saturation: %d}", &brightness, &hue,
+             &saturation);
 
   if (hue != -1 && (hue < 0 || hue > 360)) {
     return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid hue: %d (only 0-360)",
@@ -383,6 +400,20 @@ Status LightBulb::SetState(const std::string &state_json) {
                         "invalid brightness: %d (only 0-100)", brightness);
   }
 
+  return Status::OK();
+}
+
+Status LightBulb::SetState(const std::string &state_json) {
+  Status st = ValidateState(state_json);
+  if (!st.ok()) return st;
+
+  int8_t state = -1;
+  int brightness = -1, hue = -1, saturation = -1;
+
+  json_scanf(state_json.c_str(), state_json.size(),
+             "{state: %B, brightness: %d, hue: %d, saturation: %d}", &state,
+             &brightness, &hue, &saturation);
+
   if (state != -1) UpdateOnOff(static_cast<bool>(state), "RPC");
   if (hue != -1) SetHue(hue, "RPC");
   if (saturation != -1) SetSaturation(saturation, "RPC");
@@ -411,6 +442,55 @@ bool LightBulb::IsAutoOffEnabled() const {
   return cfg_->auto_off != 0;
 }
 
+bool LightBulb::IsDimmingEnabled() const {
+  return (static_cast<InMode>(cfg_->in_mode) == InMode::kMomentary &&
+          cfg_->dim_rate > 0);
+}
+
+void LightBulb::UpdateHoldRepeat() {
+  if (in_ == nullptr) return;
+  in_->SetHoldRepeatMs(IsDimmingEnabled() ? kDimStepIntervalMs : 0);
+}
+
+void LightBulb::StartDimming() {
+  dimming_ = true;
+  if (IsOff()) UpdateOnOff(true, "dim");
+  if (cfg_->brightness >= 100) dim_up_ = false;
+  if (cfg_->brightness <= 1) dim_up_ = true;
+  dim_brightness_ = cfg_->brightness;
+  dim_last_ts_ = in_->GetLastEventTime();
+  LOG(LL_INFO, ("Dimming %s from %d", (dim_up_ ? "up" : "down"),
+                cfg_->brightness));
+}
+
+void LightBulb::DimStep() {
+  if (!dimming_) return;
+  int64_t ts = in_->GetLastEventTime();
+  int step_ms = (ts - dim_last_ts_) / 1000;
+  dim_last_ts_ = ts;
+  float step = cfg_->dim_rate * step_ms / 1000.0f;
+  dim_brightness_ += (dim_up_ ? step : -step);
+  // Dimming never turns the light off.
+  dim_brightness_ = std::max(1.0f, std::min(100.0f, dim_brightness_));
+  int brightness = static_cast<int>(dim_brightness_ + 0.5f);
+  if (brightness == cfg_->brightness) return;
+  // Config and HAP are updated once, when dimming ends.
+  cfg_->brightness = brightness;
+  InvalidateInfo();
+  // Fade over the step interval for a smooth ramp.
+  StartTransition(step_ms);
+}
+
+void LightBulb::StopDimming() {
+  if (!dimming_) return;
+  dimming_ = false;
+  dim_up_ = !dim_up_;
+  LOG(LL_INFO, ("Brightness changed (dim): %d", cfg_->brightness));
+  StateJournalPut(Type::kLightBulb, id(), StateKey::kBrightness,
+                  cfg_->brightness);
+  brightness_characteristic->RaiseEvent();
+}
+
 void LightBulb::AutoOffTimerCB() {
   // Don't set state if auto off has been disabled during timer run
   if (!IsAutoOffEnabled()) return;
@@ -425,27 +505,34 @@ void LightBulb::AutoOffTimerCB() {
 }
 
 void LightBulb::TransitionTimerCB() {
-  int64_t elapsed = mgos_uptime_micros() - transition_start_;
-  int64_t duration = cfg_->transition_time * 1000;
+  uint32_t elapsed = mgos_uptime_micros() - transition_start_;
+  uint32_t duration = transition_time_ms_ * 1000;
 
-  if (elapsed > duration) {
+  if (elapsed >= duration) {
     transition_timer_.Clear();
     rgbw_now_ = rgbw_end_;
-    LOG(LL_INFO, ("Transition ready"));
+    LOG((dimming_ ? LL_DEBUG : LL_INFO), ("Transition ready"));
   } else {
-    float alpha = static_cast<float>(elapsed) / static_cast<float>(duration);
-    rgbw_now_.r = alpha * rgbw_end_.r + (1 - alpha) * rgbw_start_.r;
-    rgbw_now_.g = alpha * rgbw_end_.g + (1 - alpha) * rgbw_start_.g;
-    rgbw_now_.b = alpha * rgbw_end_.b + (1 - alpha) * rgbw_start_.b;
-    rgbw_now_.w = alpha * rgbw_end_.w + (1 - alpha) * rgbw_start_.w;
+    // Progress in Q15, scale long durations down to keep it within 32 bits.
+    while (duration >= (1 << 17)) {
+      duration >>= 1;
+      elapsed >>= 1;
+    }
+    uint32_t alpha = (elapsed << 15) / duration;
+    rgbw_now_.r = LightLevelLerp(rgbw_start_.r, rgbw_end_.r, alpha);
+    rgbw_now_.g = LightLevelLerp(rgbw_start_.g, rgbw_end_.g, alpha);
+    rgbw_now_.b = LightLevelLerp(rgbw_start_.b, rgbw_end_.b, alpha);
+    rgbw_now_.w = LightLevelLerp(rgbw_start_.w, rgbw_end_.w, alpha);
   }
 
-  out_r_->SetStatePWM(rgbw_now_.r, "transition");
-  out_g_->SetStatePWM(rgbw_now_.g, "transition");
-  out_b_->SetStatePWM(rgbw_now_.b, "transition");
+  // Outputs skip writes that do not change quantized duty.
+  LightCurve curve = static_cast<LightCurve>(cfg_->curve);
+  SetOutputLevel(out_r_, curve, rgbw_now_.r);
+  SetOutputLevel(out_g_, curve, rgbw_now_.g);
+  SetOutputLevel(out_b_, curve, rgbw_now_.b);
 
   if (out_w_ != nullptr) {
-    out_w_->SetStatePWM(rgbw_now_.w, "transition");
+    SetOutputLevel(out_w_, curve, rgbw_now_.w);
   }
 }
 
@@ -459,7 +546,9 @@ void LightBulb::InputEventHandler(Input::Event ev, bool state) {
     case Input::Event::kChange: {
       switch (static_cast<InMode>(cfg_->in_mode)) {
         case InMode::kMomentary:
-          if (state) {  // Only on 0 -> 1 transitions.
+          // With dimming enabled, press may turn out to be a hold,
+          // toggle on single press instead.
+          if (state && !IsDimmingEnabled()) {  // Only on 0 -> 1 transitions.
             UpdateOnOff(IsOff(), "ext_mom");
           }
           break;
@@ -486,14 +575,24 @@ void LightBulb::InputEventHandler(Input::Event ev, bool state) {
       break;
     }
     case Input::Event::kLong:
+      if (IsDimmingEnabled()) StartDimming();
       // Disable auto-off if it was active.
       if (in_mode == InMode::kMomentary) {
         DisableAutoOff();
       }
       break;
+    case Input::Event::kHoldRepeat:
+      DimStep();
+      break;
+    case Input::Event::kLongRelease:
+      StopDimming();
+      break;
     case Input::Event::kSingle:
+      if (IsDimmingEnabled()) UpdateOnOff(IsOff(), "ext_mom");
+      break;
     case Input::Event::kDouble:
     case Input::Event::kReset:
+    case Input::Event::kTriple:
     case Input::Event::kMax:
       break;
   }
@@ -25,6 +25,7 @@
 #include "shelly_common.hpp"
 #include "shelly_component.hpp"
 #include "shelly_input.hpp"
+#include "shelly_light_color.hpp"
 #include "shelly_output.hpp"
 
 namespace shelly {
@@ -36,13 +37,6 @@ class LightBulb : public Component, public mgos::hap::Service {
             Output *out_w, struct mgos_config_lb *cfg);
   virtual ~LightBulb();
 
-  struct RGBW {
-    float r;
-    float g;
-    float b;
-    float w;
-  };
-
   // Component interface impl.
   Type type() const override;
   std::string name() const override;
@@ -52,7 +46,9 @@ class LightBulb : public Component, public mgos::hap::Service {
   StatusOr<std::string> GetInfoJSON() const override;
   Status SetConfig(const std::string &config_json,
                    bool *restart_required) override;
+  Status ValidateConfig(const std::string &config_json) const override;
   Status SetState(const std::string &state_json) override;
+  Status ValidateState(const std::string &state_json) const override;
 
  protected:
   void InputEventHandler(Input::Event ev, bool state);
@@ -68,10 +64,23 @@ class LightBulb : public Component, public mgos::hap::Service {
   bool IsOn() const;
   bool IsOff() const;
   bool IsAutoOffEnabled() const;
-
-  void HSVtoRGBW(RGBW &rgbw) const;
-  void StartTransition();
-  void SaveState();
+  bool IsDimmingEnabled() const;
+  // Hold repeat events are only needed for dimming.
+  void UpdateHoldRepeat();
+
+  // Hold-to-dim, driven by long press, hold repeat and release events.
+  void StartDimming();
+  void DimStep();
+  void StopDimming();
+
+  // duration_ms < 0 means use configured transition time.
+  void StartTransition(int duration_ms = -1);
+  // Interval at which transition updates become visible at PWM resolution.
+  int GetTransitionTickMs() const;
+  void RestoreState();
+  // Parses config_json over the current config. cfg->name must be freed.
+  Status ParseConfig(const std::string &config_json,
+                     struct mgos_config_lb *cfg, int8_t *in_inverted) const;
   void ResetAutoOff();
   void DisableAutoOff();
 
@@ -86,14 +95,22 @@ class LightBulb : public Component, public mgos::hap::Service {
   mgos::hap::UInt32Characteristic *saturation_characteristic;
 
   mgos::Timer auto_off_timer_;
-  bool dirty_ = false;
 
+  static constexpr int kDimStepIntervalMs = 250;
+  static constexpr int kMinTransitionTickMs = 10;
+  static constexpr int kMaxTransitionTickMs = 100;
   mgos::Timer transition_timer_;
   int64_t transition_start_ = 0;
+  int transition_time_ms_ = 0;
   RGBW rgbw_start_{};
   RGBW rgbw_now_{};
   RGBW rgbw_end_{};
 
+  bool dimming_ = false;
+  bool dim_up_ = true;        // Direction of the next ramp.
+  float dim_brightness_ = 0;  // Not rounded, small steps accumulate.
+  int64_t dim_last_ts_ = 0;   // Time of the last step.
+
   HAPError HandleOnRead(HAPAccessoryServerRef *server,
                         const HAPBoolCharacteristicReadRequest *request,
                         bool *value);
@@ -57,16 +57,18 @@ Status Outlet::Init() {
       kHAPCharacteristicDebugDescription_On);
   state_notify_chars_.push_back(on_char);
   AddChar(on_char);
-  // Outlet In Use
-  AddChar(new mgos::hap::BoolCharacteristic(
+  // Outlet In Use, can be driven by a power rule.
+  auto *in_use_char = new mgos::hap::BoolCharacteristic(
       iid++, &kHAPCharacteristicType_OutletInUse,
-      [](HAPAccessoryServerRef *, const HAPBoolCharacteristicReadRequest *,
-         bool *value) {
-        *value = true;
+      [this](HAPAccessoryServerRef *, const HAPBoolCharacteristicReadRequest *,
+             bool *value) {
+        *value = in_use_;
         return kHAPError_None;
       },
       true /* supports_notification */, nullptr /* write_handler */,
-      kHAPCharacteristicDebugDescription_OutletInUse));
+      kHAPCharacteristicDebugDescription_OutletInUse);
+  in_use_notify_chars_.push_back(in_use_char);
+  AddChar(in_use_char);
 
   return Status::OK();
 }
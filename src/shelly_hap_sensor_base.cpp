@@ -79,15 +79,13 @@ StatusOr<std::string> SensorBase::GetInfoJSON() const {
       cfg_->idle_time, state_, last_ev_age);
 }
 
-Status SensorBase::SetConfig(const std::string &config_json,
-                             bool *restart_required) {
+Status SensorBase::ValidateConfig(const std::string &config_json) const {
   char *name = nullptr;
   int in_mode = -1, idle_time = -1;
   json_scanf(config_json.c_str(), config_json.size(),
              "{name: %Q, in_mode: %d, idle_time: %d}", &name, &in_mode,
              &idle_time);
   mgos::ScopedCPtr name_owner(name);
-  // Validation.
   if (name != nullptr && strlen(name) > 64) {
     return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s",
                         "name (too long, max 64)");
@@ -98,6 +96,19 @@ Status SensorBase::SetConfig(const std::string &config_json,
   if (idle_time != -1 && (idle_time <= 0 || idle_time > 10000)) {
     return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "idle_time");
   }
+  return Status::OK();
+}
+
+Status SensorBase::SetConfig(const std::string &config_json,
+                             bool *restart_required) {
+  Status st = ValidateConfig(config_json);
+  if (!st.ok()) return st;
+  char *name = nullptr;
+  int in_mode = -1, idle_time = -1;
+  json_scanf(config_json.c_str(), config_json.size(),
+             "{name: %Q, in_mode: %d, idle_time: %d}", &name, &in_mode,
+             &idle_time);
+  mgos::ScopedCPtr name_owner(name);
   // Now copy over.
   if (name != nullptr && strcmp(name, cfg_->name) != 0) {
     mgos_conf_set_str(&cfg_->name, name);
@@ -111,6 +122,7 @@ Status SensorBase::SetConfig(const std::string &config_json,
   if (idle_time != -1) {
     cfg_->idle_time = idle_time;
   }
+  InvalidateInfo();
   return Status::OK();
 }
 
@@ -119,6 +131,11 @@ Status SensorBase::SetState(const std::string &state_json) {
   return Status::UNIMPLEMENTED();
 }
 
+int SensorBase::GetInfoMaxAgeMs() const {
+  // Last event age keeps changing once there has been an event.
+  return (last_ev_ts_ > 0 ? 1000 : -1);
+}
+
 HAPError SensorBase::BoolStateCharRead(HAPAccessoryServerRef *,
                                        const HAPBoolCharacteristicReadRequest *,
                                        bool *value) {
@@ -150,6 +167,7 @@ void SensorBase::SetInternalState(bool state) {
       last_ev_ts_ = mgos_uptime();
     }
     state_ = state;
+    InvalidateInfo();
     // May happen during init, we don't want to raise events until initialized.
     if (handler_id_ != Input::kInvalidHandlerID) {
       chars_[1]->RaiseEvent();
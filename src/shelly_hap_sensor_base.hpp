@@ -48,7 +48,9 @@ class SensorBase : public Component, public mgos::hap::Service {
   StatusOr<std::string> GetInfoJSON() const override;
   Status SetConfig(const std::string &config_json,
                    bool *restart_required) override;
+  Status ValidateConfig(const std::string &config_json) const override;
   Status SetState(const std::string &state_json) override;
+  int GetInfoMaxAgeMs() const override;
 
  protected:
   HAPError BoolStateCharRead(HAPAccessoryServerRef *,
@@ -94,14 +94,13 @@ StatusOr<std::string> StatelessSwitchBase::GetInfoJSON() const {
       last_ev_age);
 }
 
-Status StatelessSwitchBase::SetConfig(const std::string &config_json,
-                                      bool *restart_required) {
+Status StatelessSwitchBase::ValidateConfig(
+    const std::string &config_json) const {
   char *name = nullptr;
   int in_mode = -1;
   json_scanf(config_json.c_str(), config_json.size(), "{name: %Q, in_mode: %d}",
              &name, &in_mode);
   mgos::ScopedCPtr name_owner(name);
-  // Validation.
   if (name != nullptr && strlen(name) > 64) {
     return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s",
                         "name (too long, max 64)");
@@ -109,12 +108,25 @@ Status StatelessSwitchBase::SetConfig(const std::string &config_json,
   if (in_mode < 0 || in_mode > 2) {
     return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "in_mode");
   }
+  return Status::OK();
+}
+
+Status StatelessSwitchBase::SetConfig(const std::string &config_json,
+                                      bool *restart_required) {
+  Status st = ValidateConfig(config_json);
+  if (!st.ok()) return st;
+  char *name = nullptr;
+  int in_mode = -1;
+  json_scanf(config_json.c_str(), config_json.size(), "{name: %Q, in_mode: %d}",
+             &name, &in_mode);
+  mgos::ScopedCPtr name_owner(name);
   // Now copy over.
   if (name != nullptr && strcmp(name, cfg_->name) != 0) {
     mgos_conf_set_str(&cfg_->name, name);
     *restart_required = true;
   }
   cfg_->in_mode = in_mode;
+  InvalidateInfo();
   return Status::OK();
 }
 
@@ -123,7 +135,14 @@ Status StatelessSwitchBase::SetState(const std::string &state_json) {
   return Status::UNIMPLEMENTED();
 }
 
+int StatelessSwitchBase::GetInfoMaxAgeMs() const {
+  // Last event age keeps changing once there has been an event.
+  return (last_ev_ts_ > 0 ? 1000 : -1);
+}
+
 void StatelessSwitchBase::InputEventHandler(Input::Event ev, bool state) {
+  // Input state is part of the status.
+  if (ev == Input::Event::kChange) InvalidateInfo();
   const auto in_mode = static_cast<InMode>(cfg_->in_mode);
   switch (in_mode) {
     // In momentary input mode we translate input events to HAP events directly.
@@ -142,6 +161,9 @@ void StatelessSwitchBase::InputEventHandler(Input::Event ev, bool state) {
           break;
         case Input::Event::kChange:
         case Input::Event::kReset:
+        case Input::Event::kTriple:  // HAP has no triple press.
+        case Input::Event::kHoldRepeat:
+        case Input::Event::kLongRelease:
         case Input::Event::kMax:
           // Ignore.
           break;
@@ -163,6 +185,7 @@ void StatelessSwitchBase::InputEventHandler(Input::Event ev, bool state) {
 void StatelessSwitchBase::RaiseEvent(uint8_t ev) {
   last_ev_ = ev;
   last_ev_ts_ = mgos_uptime();
+  InvalidateInfo();
   LOG(LL_INFO, ("Input %d: HAP event (mode %d): %d", id(), cfg_->in_mode, ev));
   // May happen during init, we don't want to raise events until initialized.
   if (handler_id_ != Input::kInvalidHandlerID) {
@@ -55,7 +55,9 @@ class StatelessSwitchBase : public Component, public mgos::hap::Service {
   StatusOr<std::string> GetInfoJSON() const override;
   Status SetConfig(const std::string &config_json,
                    bool *restart_required) override;
+  Status ValidateConfig(const std::string &config_json) const override;
   Status SetState(const std::string &state_json) override;
+  int GetInfoMaxAgeMs() const override;
 
  private:
   void InputEventHandler(Input::Event ev, bool state);
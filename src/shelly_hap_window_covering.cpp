@@ -17,11 +17,15 @@
 
 #include "shelly_hap_window_covering.hpp"
 
+#include <algorithm>
 #include <cmath>
 
 #include "mgos.hpp"
 #include "mgos_system.hpp"
 
+#include "shelly_config_saver.hpp"
+#include "shelly_state_journal.hpp"
+
 namespace shelly {
 namespace hap {
 
@@ -36,8 +40,7 @@ WindowCovering::WindowCovering(int id, Input *in0, Input *in1, Output *out0,
       cfg_(cfg),
       state_timer_(std::bind(&WindowCovering::RunOnce, this)),
       cur_pos_(cfg_->current_pos),
-      tgt_pos_(cfg_->current_pos),
-      move_ms_per_pct_(cfg_->move_time_ms / 100.0) {
+      tgt_pos_(cfg_->current_pos) {
   if (!cfg_->swap_inputs) {
     in_open_ = in0;
     in_close_ = in1;
@@ -67,10 +70,14 @@ WindowCovering::~WindowCovering() {
   }
   out_open_->SetState(false, "dtor");
   out_close_->SetState(false, "dtor");
-  SaveState();
 }
 
 Status WindowCovering::Init() {
+  int32_t pos;
+  if (StateJournalGet(Type::kWindowCovering, id(), StateKey::kPosition, &pos)) {
+    // Stored in hundredths of a percent.
+    cur_pos_ = tgt_pos_ = cfg_->current_pos = pos / 100.0;
+  }
   uint16_t iid = svc_.iid + 1;
   // Name
   AddNameChar(iid++, cfg_->name);
@@ -171,7 +178,6 @@ Status WindowCovering::Init() {
   } else {
     LOG(LL_INFO, ("WC %d: not calibrated", id()));
   }
-  state_timer_.Reset(100, MGOS_TIMER_REPEAT);
   return Status::OK();
 }
 
@@ -184,10 +190,11 @@ std::string WindowCovering::name() const {
 }
 
 StatusOr<std::string> WindowCovering::GetInfo() const {
-  return mgos::SPrintf("c:%d mp:%.2f mt_ms:%d cp:%.2f tp:%.2f lemd:%d lhmd:%d",
-                       cfg_->calibrated, cfg_->move_power, cfg_->move_time_ms,
-                       cur_pos_, tgt_pos_, (int) last_ext_move_dir_,
-                       (int) last_hap_move_dir_);
+  return mgos::SPrintf(
+      "c:%d mp:%.2f mt_ms:%d cp:%.2f tp:%.2f lemd:%d lhmd:%d nr:%u",
+      cfg_->calibrated, cfg_->move_power, cfg_->move_time_ms, cur_pos_,
+      tgt_pos_, (int) last_ext_move_dir_, (int) last_hap_move_dir_,
+      (unsigned) num_runs_);
 }
 
 StatusOr<std::string> WindowCovering::GetInfoJSON() const {
@@ -195,15 +202,35 @@ StatusOr<std::string> WindowCovering::GetInfoJSON() const {
       "{id: %d, type: %d, name: %Q, "
       "in_mode: %d, swap_inputs: %B, swap_outputs: %B, "
       "cal_done: %B, move_time_ms: %d, move_power: %d, "
+      "open_time_ms: %d, close_time_ms: %d, ramp_up_time_ms: %d, "
       "state: %d, state_str: %Q, cur_pos: %d, tgt_pos: %d}",
       id(), type(), cfg_->name, cfg_->in_mode, cfg_->swap_inputs,
       cfg_->swap_outputs, cfg_->calibrated, cfg_->move_time_ms,
-      (int) cfg_->move_power, (int) state_, StateStr(state_), (int) cur_pos_,
-      (int) tgt_pos_);
+      (int) cfg_->move_power, GetTravelTimeMs(Direction::kOpen),
+      GetTravelTimeMs(Direction::kClose), cfg_->ramp_up_time_ms, (int) state_,
+      StateStr(state_), (int) cur_pos_, (int) tgt_pos_);
+}
+
+Status WindowCovering::ValidateConfig(const std::string &config_json) const {
+  char *name = nullptr;
+  int in_mode = -1;
+  json_scanf(config_json.c_str(), config_json.size(),
+             "{name: %Q, in_mode: %d}", &name, &in_mode);
+  mgos::ScopedCPtr name_owner(name);
+  if (name != nullptr && strlen(name) > 64) {
+    return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s",
+                        "name (too long, max 64)");
+  }
+  if (in_mode > 3) {
+    return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "in_mode");
+  }
+  return Status::OK();
 }
 
 Status WindowCovering::SetConfig(const std::string &config_json,
                                  bool *restart_required) {
+  Status st = ValidateConfig(config_json);
+  if (!st.ok()) return st;
   struct mgos_config_wc cfg = *cfg_;
   cfg.name = nullptr;
   int in_mode = -1;
@@ -212,14 +239,6 @@ Status WindowCovering::SetConfig(const std::string &config_json,
              "{name: %Q, in_mode: %d, swap_inputs: %B, swap_outputs: %B}",
              &cfg.name, &in_mode, &swap_inputs, &swap_outputs);
   mgos::ScopedCPtr name_owner((void *) cfg.name);
-  // Validate.
-  if (cfg.name != nullptr && strlen(cfg.name) > 64) {
-    return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s",
-                        "name (too long, max 64)");
-  }
-  if (in_mode > 3) {
-    return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "in_mode");
-  }
   // Apply.
   if (cfg.name != nullptr && strcmp(cfg_->name, cfg.name) != 0) {
     mgos_conf_set_str(&cfg_->name, cfg.name);
@@ -237,21 +256,31 @@ Status WindowCovering::SetConfig(const std::string &config_json,
     cfg_->swap_outputs = swap_outputs;
     *restart_required = true;
   }
+  InvalidateInfo();
+  return Status::OK();
+}
+
+Status WindowCovering::ValidateState(const std::string &state_json) const {
+  int state = -2;
+  json_scanf(state_json.c_str(), state_json.size(), "{state: %d}", &state);
+  if (state != -2 && strcmp(StateStr(static_cast<State>(state)), "???") == 0) {
+    return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "state");
+  }
   return Status::OK();
 }
 
 Status WindowCovering::SetState(const std::string &state_json) {
+  Status st = ValidateState(state_json);
+  if (!st.ok()) return st;
   int state = -2, tgt_pos = -2;
   json_scanf(state_json.c_str(), state_json.size(), "{state: %d, tgt_pos: %d}",
              &state, &tgt_pos);
-  if (state != -2 && strcmp(StateStr(static_cast<State>(state)), "???") == 0) {
-    return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "state");
-  }
   if (state >= 0) {
     tgt_state_ = static_cast<State>(state);
     if (state_ != State::kIdle) {
       SetInternalState(State::kStop);
     }
+    ScheduleRunOnce(0);
     return Status::OK();
   }
   if (tgt_pos >= 0) {
@@ -287,6 +316,12 @@ const char *WindowCovering::StateStr(State state) {
       return "cal1";
     case State::kPostCal1:
       return "postcal1";
+    case State::kPreCal2:
+      return "precal2";
+    case State::kCal2:
+      return "cal2";
+    case State::kPostCal2:
+      return "postcal2";
     case State::kMove:
       return "move";
     case State::kRampUp:
@@ -313,16 +348,21 @@ float WindowCovering::TrimPos(float pos) {
   return pos;
 }
 
-void WindowCovering::SaveState() {
-  mgos_sys_config_save(&mgos_sys_config, false /* try_once */, NULL /* msg */);
-}
-
 void WindowCovering::SetInternalState(State new_state) {
   if (state_ == new_state) return;
   LOG(LL_INFO, ("WC %d: State: %s -> %s (%d -> %d)", id(), StateStr(state_),
                 StateStr(new_state), (int) state_, (int) new_state));
   state_ = new_state;
   begin_ = mgos_uptime_micros();
+  // Power is monitored closely while motor may be running.
+  bool active = (state_ != State::kNone && state_ != State::kIdle &&
+                 state_ != State::kError);
+  pm_open_->SetFastSampling(active);
+  pm_close_->SetFastSampling(active);
+  InvalidateInfo();
+  // Make sure state machine gets to process the new state. When called from
+  // the state machine itself, RunOnce() will reschedule as appropriate.
+  ScheduleRunOnce(0);
 }
 
 void WindowCovering::SetCurPos(float new_cur_pos, float p) {
@@ -333,16 +373,27 @@ void WindowCovering::SetCurPos(float new_cur_pos, float p) {
                new_cur_pos, p));
   cur_pos_ = new_cur_pos;
   cfg_->current_pos = cur_pos_;
+  InvalidateInfo();
   cur_pos_char_->RaiseEvent();
 }
 
+// Position changes many times during a move, it is only persisted
+// once the motor has stopped.
+void WindowCovering::SaveCurPos() {
+  StateJournalPut(Type::kWindowCovering, id(), StateKey::kPosition,
+                  (int32_t) (cur_pos_ * 100));
+}
+
 void WindowCovering::SetTgtPos(float new_tgt_pos, const char *src) {
   new_tgt_pos = TrimPos(new_tgt_pos);
   if (new_tgt_pos == tgt_pos_) return;
   LOG(LL_INFO,
       ("WC %d: Tgt pos %.2f -> %.2f (%s)", id(), tgt_pos_, new_tgt_pos, src));
   tgt_pos_ = new_tgt_pos;
+  InvalidateInfo();
   tgt_pos_char_->RaiseEvent();
+  // Make sure state machine picks up the change.
+  ScheduleRunOnce(0);
 }
 
 // We want tile taps to cycle the open-stop-close-stop sequence.
@@ -417,9 +468,160 @@ void WindowCovering::Move(Direction dir) {
   out_close_->SetState(want_close, ss);
   if (moving_dir_ != dir) pos_state_char_->RaiseEvent();
   moving_dir_ = dir;
+  move_begin_ = mgos_uptime_micros();
+  pos_tracking_ = false;
+}
+
+int WindowCovering::GetTravelTimeMs(Direction dir) const {
+  int travel_time_ms = 0;
+  if (dir == Direction::kOpen) {
+    travel_time_ms = cfg_->open_time_ms;
+  } else if (dir == Direction::kClose) {
+    travel_time_ms = cfg_->close_time_ms;
+  }
+  // Calibrated before separate times were introduced.
+  if (travel_time_ms <= 0) travel_time_ms = cfg_->move_time_ms;
+  return std::max(travel_time_ms, 1);
+}
+
+// Position is computed from the time outputs were turned on rather than
+// when movement was detected to avoid accumulating PM sampling error.
+float WindowCovering::GetModelPos(int64_t now) const {
+  int64_t travel_us = now - move_begin_ - cfg_->ramp_up_time_ms * 1000;
+  if (travel_us < 0) travel_us = 0;
+  // Travel time in ms * 1000 us/ms / 100%.
+  float pos_diff = travel_us / (GetTravelTimeMs(moving_dir_) * 10.0f);
+  return (moving_dir_ == Direction::kOpen ? move_start_pos_ + pos_diff
+                                          : move_start_pos_ - pos_diff);
+}
+
+bool WindowCovering::IsEndStop(float p) const {
+  if (p < cfg_->idle_power_thr) return true;
+  // Some motors do not cut power entirely at the end stop.
+  if (cfg_->end_stop_power_ratio > 0 && p_num_ > 0) {
+    float avg_p = p_sum_ / p_num_;
+    return (p < avg_p * cfg_->end_stop_power_ratio);
+  }
+  return false;
+}
+
+void WindowCovering::ResetPowerStats() {
+  p_stats_n_ = 0;
+  p_mean_ = p_var_ = 0;
+}
+
+// Tracks exponentially weighted mean and variance of the motor power
+// and checks every new sample against them and the calibrated move power.
+WindowCovering::PowerEvent WindowCovering::AnalyzePower(float p) {
+  PowerEvent ev = PowerEvent::kNone;
+  if (p_stats_n_ >= kPowerMinSamples) {
+    float sd = std::sqrt(p_var_);
+    if (p > p_mean_ + kPowerSpikeSigma * sd &&
+        p > cfg_->move_power * kPowerSpikeMinRatio) {
+      ev = PowerEvent::kSpike;
+    } else if (p < cfg_->idle_power_thr ||
+               (p < p_mean_ - kPowerSpikeSigma * sd &&
+                p < cfg_->move_power * kPowerDropMaxRatio)) {
+      ev = PowerEvent::kDrop;
+    }
+  }
+  if (ev != PowerEvent::kNone) {
+    LOG(LL_INFO, ("WC %d: Power %s: p %.2f mean %.2f var %.2f", id(),
+                  (ev == PowerEvent::kSpike ? "spike" : "drop"), p, p_mean_,
+                  p_var_));
+    // Do not let the anomaly skew the stats.
+    return ev;
+  }
+  if (p_stats_n_ == 0) {
+    p_mean_ = p;
+  } else {
+    float diff = p - p_mean_;
+    float incr = kPowerAlpha * diff;
+    p_mean_ += incr;
+    p_var_ = (1 - kPowerAlpha) * (p_var_ + diff * incr);
+  }
+  p_stats_n_++;
+  return ev;
+}
+
+void WindowCovering::StopOnObstruction(float p, int moving_time_ms) {
+  LOG(LL_ERROR, ("Obstruction: p = %.2f t = %d", p, moving_time_ms));
+  Move(Direction::kNone);  // Stop right away.
+  obstruction_detected_ = true;
+  obst_char_->RaiseEvent();
+  tgt_state_ = State::kError;
+  SetInternalState(State::kStop);
+}
+
+void WindowCovering::BeginTravelMeasurement() {
+  last_sample_ts_ = active_begin_ = active_end_ = 0;
+}
+
+// Motor start and stop times are taken to be half way between samples.
+bool WindowCovering::MeasureTravel(float p, int *ramp_up_time_ms,
+                                   int *travel_time_ms) {
+  int64_t now = mgos_uptime_micros();
+  int64_t prev_sample_ts = (last_sample_ts_ > 0 ? last_sample_ts_ : begin_);
+  last_sample_ts_ = now;
+  if (p >= cfg_->idle_power_thr) {
+    if (active_begin_ == 0) active_begin_ = (prev_sample_ts + now) / 2;
+    active_end_ = now;
+    p_sum_ += p;
+    p_num_++;
+    return false;
+  }
+  // Motor may not have started yet.
+  if (now - begin_ < cfg_->max_ramp_up_time_ms * 1000) return false;
+  if (active_begin_ == 0) return true;
+  int64_t end = (active_end_ + now) / 2;
+  *ramp_up_time_ms = (active_begin_ - begin_) / 1000;
+  *travel_time_ms = (end - active_begin_) / 1000;
+  return true;
 }
 
 void WindowCovering::RunOnce() {
+  num_runs_++;
+  RunStateMachine();
+  ScheduleRunOnce(GetNextRunDelayMs());
+}
+
+// Returns the delay until the next state machine step, -1 if none is needed.
+int WindowCovering::GetNextRunDelayMs() const {
+  switch (state_) {
+    case State::kNone:
+    case State::kIdle:
+      // Nothing to do until target position or state is changed.
+      return -1;
+    case State::kMoving: {
+      // Moving to a limit position, wait for the motor to stop.
+      if (tgt_pos_ == kFullyOpen || tgt_pos_ == kFullyClosed) {
+        return kPollIntervalMs;
+      }
+      // Otherwise wake up in time to stop at the target position
+      // but still keep an eye on power to detect obstruction.
+      float tgt_travel_ms = std::abs(tgt_pos_ - move_start_pos_) *
+                            GetTravelTimeMs(moving_dir_) / 100;
+      int64_t tgt_ts =
+          move_begin_ +
+          (int64_t) ((cfg_->ramp_up_time_ms + tgt_travel_ms) * 1000);
+      int tgt_ms = (tgt_ts - mgos_uptime_micros()) / 1000 + 1;
+      return std::max(0, std::min(tgt_ms, kPollIntervalMs));
+    }
+    default:
+      // Calibration, ramp up, stopping: power needs to be monitored.
+      return kPollIntervalMs;
+  }
+}
+
+void WindowCovering::ScheduleRunOnce(int delay_ms) {
+  if (delay_ms < 0) {
+    state_timer_.Clear();
+  } else {
+    state_timer_.Reset(delay_ms, 0);
+  }
+}
+
+void WindowCovering::RunStateMachine() {
   const char *ss = StateStr(state_);
   if (state_ != State::kIdle) {
     LOG(LL_DEBUG, ("WC %d: %s md %d pos %.2f -> %.2f", id(), ss,
@@ -443,7 +645,7 @@ void WindowCovering::RunOnce() {
       out_close_->SetState(false, ss);
       LOG(LL_INFO, ("Begin calibration"));
       cfg_->calibrated = false;
-      SaveState();
+      RequestConfigSave();
       out_open_->SetState(true, ss);
       out_close_->SetState(false, ss);
       SetInternalState(State::kCal0);
@@ -476,39 +678,74 @@ void WindowCovering::RunOnce() {
       out_close_->SetState(true, ss);
       p_sum_ = 0;
       p_num_ = 0;
+      BeginTravelMeasurement();
       SetInternalState(State::kCal1);
       break;
     }
-    case State::kCal1: {
-      auto p1v = pm_close_->GetPowerW();
-      if (!p1v.ok()) {
+    case State::kCal1:
+    case State::kCal2: {
+      bool closing = (state_ == State::kCal1);
+      auto pv = (closing ? pm_close_ : pm_open_)->GetPowerW();
+      if (!pv.ok()) {
         LOG(LL_ERROR, ("PM error"));
         SetInternalState(State::kError);
         break;
       }
-      const float p1 = p1v.ValueOrDie();
-      int move_time_ms = (mgos_uptime_micros() - begin_) / 1000;
-      LOG_EVERY_N(LL_INFO, 8, ("WC %d: P1 = %.3f", id(), p1));
-      if (p1 < cfg_->idle_power_thr && move_time_ms > 1000) {
-        out_close_->SetState(false, StateStr(state_));
-        float move_power = p_sum_ / p_num_;
-        LOG(LL_INFO, ("WC %d: calibration done, move_time %d, move_power %.3f",
-                      id(), move_time_ms, move_power));
-        cfg_->move_time_ms = move_time_ms;
-        cfg_->move_power = move_power;
-        move_ms_per_pct_ = cfg_->move_time_ms / 100.0;
+      const float p = pv.ValueOrDie();
+      LOG_EVERY_N(LL_INFO, 8,
+                  ("WC %d: P%d = %.3f", id(), (closing ? 1 : 2), p));
+      int ramp_up_time_ms = 0, travel_time_ms = 0;
+      if (!MeasureTravel(p, &ramp_up_time_ms, &travel_time_ms)) break;
+      (closing ? out_close_ : out_open_)->SetState(false, ss);
+      if (active_begin_ == 0) {
+        LOG(LL_ERROR, ("WC %d: motor did not start", id()));
+        SetInternalState(State::kError);
+        break;
+      }
+      LOG(LL_INFO, ("WC %d: %s time %d, ramp up %d", id(),
+                    (closing ? "close" : "open"), travel_time_ms,
+                    ramp_up_time_ms));
+      if (closing) {
+        cal_close_time_ms_ = travel_time_ms;
+        cal_ramp_up_time_ms_ = ramp_up_time_ms;
         SetInternalState(State::kPostCal1);
       } else {
-        p_sum_ += p1;
-        p_num_++;
+        float move_power = p_sum_ / p_num_;
+        int open_time_ms = travel_time_ms;
+        ramp_up_time_ms = (ramp_up_time_ms + cal_ramp_up_time_ms_) / 2;
+        LOG(LL_INFO, ("WC %d: calibration done, open %d close %d ramp up %d, "
+                      "move_power %.3f",
+                      id(), open_time_ms, cal_close_time_ms_, ramp_up_time_ms,
+                      move_power));
+        cfg_->open_time_ms = open_time_ms;
+        cfg_->close_time_ms = cal_close_time_ms_;
+        cfg_->ramp_up_time_ms = ramp_up_time_ms;
+        cfg_->move_time_ms =
+            std::max(open_time_ms, cal_close_time_ms_) + ramp_up_time_ms;
+        cfg_->move_power = move_power;
+        SetInternalState(State::kPostCal2);
       }
       break;
     }
     case State::kPostCal1: {
+      out_open_->SetState(false, ss);
+      out_close_->SetState(false, ss);
+      SetInternalState(State::kPreCal2);
+      break;
+    }
+    case State::kPreCal2: {
+      out_close_->SetState(false, ss);
+      out_open_->SetState(true, ss);
+      BeginTravelMeasurement();
+      SetInternalState(State::kCal2);
+      break;
+    }
+    case State::kPostCal2: {
       cfg_->calibrated = true;
-      SetCurPos(kFullyClosed, -1);
-      SaveState();
-      SetTgtPos((kFullyOpen - kFullyClosed) / 2, "postcal1");
+      SetCurPos(kFullyOpen, -1);
+      SaveCurPos();
+      RequestConfigSave();
+      SetTgtPos((kFullyOpen - kFullyClosed) / 2, "postcal2");
       SetInternalState(State::kIdle);
       break;
     }
@@ -525,6 +762,9 @@ void WindowCovering::RunOnce() {
         obst_char_->RaiseEvent();
       }
       move_start_pos_ = cur_pos_;
+      p_sum_ = 0;
+      p_num_ = 0;
+      ResetPowerStats();
       Move(dir);
       SetInternalState(State::kRampUp);
       break;
@@ -543,6 +783,7 @@ void WindowCovering::RunOnce() {
       }
       LOG(LL_INFO, ("P = %.2f -> %.2f", p, cfg_->move_power));
       if (p >= cfg_->move_power * 0.75) {
+        pos_tracking_ = true;
         SetInternalState(State::kMoving);
         break;
       }
@@ -555,11 +796,9 @@ void WindowCovering::RunOnce() {
       break;
     }
     case State::kMoving: {
-      int moving_time_ms = (mgos_uptime_micros() - begin_) / 1000;
-      float pos_diff = moving_time_ms / move_ms_per_pct_;
-      float new_cur_pos =
-          (moving_dir_ == Direction::kOpen ? move_start_pos_ + pos_diff
-                                           : move_start_pos_ - pos_diff);
+      int64_t now = mgos_uptime_micros();
+      int moving_time_ms = (now - begin_) / 1000;
+      float new_cur_pos = GetModelPos(now);
       auto *pm = (moving_dir_ == Direction::kOpen ? pm_open_ : pm_close_);
       auto pmv = pm->GetPowerW();
       float p = -1;
@@ -572,34 +811,50 @@ void WindowCovering::RunOnce() {
         break;
       }
       SetCurPos(new_cur_pos, p);
+      if (p > cfg_->idle_power_thr) {
+        p_sum_ += p;
+        p_num_++;
+      }
+      PowerEvent pev = AnalyzePower(p);
       float too_much_power = cfg_->move_power * 2.5;
-      int too_long_time = cfg_->move_time_ms * 1.5;
-      if (p > cfg_->idle_power_thr &&
-          (p > too_much_power || moving_time_ms > too_long_time)) {
-        obstruction_detected_ = true;
-        obst_char_->RaiseEvent();
-        LOG(LL_ERROR, ("Obstruction: p = %.2f t = %d", p, moving_time_ms));
-        tgt_state_ = State::kError;
-        SetInternalState(State::kStop);
+      int too_long_time = GetTravelTimeMs(moving_dir_) * 1.5;
+      if (pev == PowerEvent::kSpike ||
+          (p > cfg_->idle_power_thr &&
+           (p > too_much_power || moving_time_ms > too_long_time))) {
+        StopOnObstruction(p, moving_time_ms);
         break;
       }
       Direction want_move_dir = GetDesiredMoveDirection();
       bool reverse =
           (want_move_dir != moving_dir_ && want_move_dir != Direction::kNone);
+      float limit_pos =
+          (moving_dir_ == Direction::kOpen ? kFullyOpen : kFullyClosed);
+      bool to_limit = (tgt_pos_ == limit_pos && !reverse);
+      if (pev == PowerEvent::kDrop && !to_limit) {
+        // Motor stopped before reaching the target, if we are close to
+        // the end, most likely position has drifted. Otherwise, something
+        // is wrong (thermal cutout, jammed), treat it as obstruction.
+        if (std::abs(limit_pos - cur_pos_) > kEarlyEndStopMaxPosError) {
+          StopOnObstruction(p, moving_time_ms);
+          break;
+        }
+        LOG(LL_INFO, ("WC %d: Early end stop at %.2f", id(), cur_pos_));
+        SetCurPos(limit_pos, p);
+        SetTgtPos(limit_pos, "endstop");
+        Move(Direction::kNone);
+        SetInternalState(State::kStop);
+        break;
+      }
       // If moving to one of the limit positions, keep moving
       // until no current is flowing.
-      if (((tgt_pos_ == kFullyOpen && moving_dir_ == Direction::kOpen) ||
-           (tgt_pos_ == kFullyClosed && moving_dir_ == Direction::kClose)) &&
-          !reverse) {
+      if (to_limit) {
         LOG_EVERY_N(LL_INFO, 8, ("Moving to %d, p %.2f", (int) tgt_pos_, p));
-        if (p > cfg_->idle_power_thr || (mgos_uptime_micros() - begin_ <
-                                         cfg_->max_ramp_up_time_ms * 1000)) {
+        if (!IsEndStop(p) ||
+            (now - begin_ < cfg_->max_ramp_up_time_ms * 1000)) {
           // Still moving or ramping up.
           break;
         } else {
-          float pos =
-              (moving_dir_ == Direction::kOpen ? kFullyOpen : kFullyClosed);
-          SetCurPos(pos, p);
+          SetCurPos(limit_pos, p);
         }
       } else if (want_move_dir == moving_dir_) {
         // Still moving.
@@ -616,8 +871,13 @@ void WindowCovering::RunOnce() {
       break;
     }
     case State::kStop: {
+      if (pos_tracking_) {
+        // Interrupted while moving, account for the last bit of travel.
+        SetCurPos(GetModelPos(mgos_uptime_micros()), -1);
+      }
       Move(Direction::kNone);
-      SaveState();
+      SaveCurPos();
+      StateJournalFlush();
       SetInternalState(State::kStopping);
       break;
     }
@@ -634,6 +894,7 @@ void WindowCovering::RunOnce() {
     }
     case State::kError: {
       Move(Direction::kNone);
+      SaveCurPos();
       SetTgtPos(cur_pos_, "error");
       SetInternalState(State::kIdle);
       break;
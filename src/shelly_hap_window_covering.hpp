@@ -55,7 +55,9 @@ class WindowCovering : public Component, public mgos::hap::Service {
   StatusOr<std::string> GetInfoJSON() const override;
   Status SetConfig(const std::string &config_json,
                    bool *restart_required) override;
+  Status ValidateConfig(const std::string &config_json) const override;
   Status SetState(const std::string &state_json) override;
+  Status ValidateState(const std::string &state_json) const override;
   bool IsIdle() override;
 
  private:
@@ -69,6 +71,9 @@ class WindowCovering : public Component, public mgos::hap::Service {
     kPreCal1 = 13,
     kCal1 = 14,
     kPostCal1 = 15,
+    kPreCal2 = 16,
+    kCal2 = 17,
+    kPostCal2 = 18,
     // Movement states
     kMove = 20,
     kRampUp = 22,
@@ -85,20 +90,35 @@ class WindowCovering : public Component, public mgos::hap::Service {
     kClose = 2,
   };
 
+  enum class PowerEvent {
+    kNone = 0,
+    kSpike = 1,  // Sudden increase, likely an obstruction.
+    kDrop = 2,   // Motor stopped drawing power, end stop reached.
+  };
+
   static constexpr float kNotSet = -1;
   static constexpr float kFullyOpen = 100;
   static constexpr float kFullyClosed = 0;
   static constexpr int kOpenOutIdx = 0;
   static constexpr int kCloseOutIdx = 1;
+  // State machine step interval while PM readings need to be monitored.
+  static constexpr int kPollIntervalMs = 100;
+  // Power anomaly detector parameters.
+  static constexpr float kPowerAlpha = 0.2;
+  static constexpr int kPowerMinSamples = 5;
+  static constexpr float kPowerSpikeSigma = 4;
+  static constexpr float kPowerSpikeMinRatio = 1.5;
+  static constexpr float kPowerDropMaxRatio = 0.5;
+  // Early end stop is accepted if position is within this distance of it.
+  static constexpr float kEarlyEndStopMaxPosError = 20;
 
   static float TrimPos(float pos);
 
   static const char *StateStr(State state);
 
-  void SaveState();
-
   void SetInternalState(State new_state);
   void SetCurPos(float new_cur_pos, float p);
+  void SaveCurPos();
   void SetTgtPos(float new_tgt_pos, const char *src);
 
   void HAPSetTgtPos(float value);
@@ -106,7 +126,22 @@ class WindowCovering : public Component, public mgos::hap::Service {
   Direction GetDesiredMoveDirection();
   void Move(Direction dir);
 
+  // Position model.
+  int GetTravelTimeMs(Direction dir) const;
+  float GetModelPos(int64_t now) const;
+  bool IsEndStop(float p) const;
+  void ResetPowerStats();
+  PowerEvent AnalyzePower(float p);
+  void StopOnObstruction(float p, int moving_time_ms);
+  void BeginTravelMeasurement();
+  // Returns true once the motor has stopped.
+  bool MeasureTravel(float p, int *ramp_up_time_ms, int *travel_time_ms);
+
+  // Runs the state machine and schedules the next run, if necessary.
   void RunOnce();
+  void RunStateMachine();
+  int GetNextRunDelayMs() const;
+  void ScheduleRunOnce(int delay_ms);
 
   void HandleInputEvent01(Direction dir, Input::Event ev, bool state);
   void HandleInputEvent2(Input::Event ev, bool state);
@@ -135,11 +170,23 @@ class WindowCovering : public Component, public mgos::hap::Service {
 
   int p_num_ = 0;
   float p_sum_ = 0;
+  // Exponentially weighted power mean and variance during movement.
+  int p_stats_n_ = 0;
+  float p_mean_ = 0;
+  float p_var_ = 0;
   int64_t begin_ = 0;
   float move_start_pos_ = 0;
-  float move_ms_per_pct_ = 0;
+  int64_t move_begin_ = 0;  // When outputs were turned on.
+  bool pos_tracking_ = false;
+  // Calibration measurements.
+  int64_t last_sample_ts_ = 0;
+  int64_t active_begin_ = 0;
+  int64_t active_end_ = 0;
+  int cal_ramp_up_time_ms_ = 0;
+  int cal_close_time_ms_ = 0;
   bool obstruction_detected_ = false;
   int64_t last_hap_set_tgt_pos_ = 0;
+  uint32_t num_runs_ = 0;
   Direction moving_dir_ = Direction::kNone;
   Direction last_ext_move_dir_ = Direction::kNone;
   Direction last_hap_move_dir_ = Direction::kNone;
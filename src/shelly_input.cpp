@@ -17,6 +17,8 @@
 
 #include "shelly_input.hpp"
 
+#include "mgos.hpp"
+
 namespace shelly {
 
 // static
@@ -41,6 +43,12 @@ const char *Input::EventName(Event ev) {
       return "long";
     case Event::kReset:
       return "reset";
+    case Event::kTriple:
+      return "triple";
+    case Event::kHoldRepeat:
+      return "hold_repeat";
+    case Event::kLongRelease:
+      return "long_release";
     case Event::kMax:
       break;
   }
@@ -69,12 +77,19 @@ void Input::RemoveHandler(HandlerID hi) {
 }
 
 void Input::InjectEvent(Event ev, bool state) {
-  CallHandlers(ev, state, true /* injected */);
+  CallHandlers(ev, state, 0 /* ts */, true /* injected */);
+}
+
+int64_t Input::GetLastEventTime() const {
+  return last_ev_ts_;
 }
 
-void Input::CallHandlers(Event ev, bool state, bool injected) {
-  LOG(LL_INFO, ("Input %d: %s (state %d)%s", id(), EventName(ev), state,
-                (injected ? " [injected]" : "")));
+void Input::CallHandlers(Event ev, bool state, int64_t ts, bool injected) {
+  last_ev_ts_ = (ts > 0 ? ts : mgos_uptime_micros());
+  // Repeats are frequent, don't flood the log.
+  LOG((ev == Event::kHoldRepeat ? LL_DEBUG : LL_INFO),
+      ("Input %d: %s (state %d)%s", id(), EventName(ev), state,
+       (injected ? " [injected]" : "")));
   for (auto &h : handlers_) {
     if (h != nullptr) h(ev, state);
   }
@@ -31,6 +31,9 @@ class Input {
     kDouble = 2,
     kLong = 3,
     kReset = 4,
+    kTriple = 5,
+    kHoldRepeat = 6,   // Periodically while held after kLong.
+    kLongRelease = 7,  // Released after kLong.
     kMax,
   };
   explicit Input(int id);
@@ -42,6 +45,9 @@ class Input {
   virtual void Init() = 0;
   virtual bool GetState() = 0;
   virtual void SetInvert(bool invert) = 0;
+  // Enables kHoldRepeat events at the specified interval, 0 disables.
+  // Off by default, inputs can stay active for a long time.
+  virtual void SetHoldRepeatMs(int interval_ms) = 0;
 
   typedef int HandlerID;
   static constexpr HandlerID kInvalidHandlerID = -1;
@@ -51,11 +57,19 @@ class Input {
 
   void InjectEvent(Event ev, bool state);
 
+  // Time of the event being delivered (or the last one delivered),
+  // uptime in microseconds. This is when the input changed, which may be
+  // earlier than when the handler is invoked.
+  int64_t GetLastEventTime() const;
+
  protected:
-  void CallHandlers(Event ev, bool state, bool injected = false);
+  // ts is the time of the event, 0 means now.
+  void CallHandlers(Event ev, bool state, int64_t ts = 0,
+                    bool injected = false);
 
  private:
   const int id_;
+  int64_t last_ev_ts_ = 0;
   std::vector<HandlerFn> handlers_;
 
   Input(const Input &other) = delete;
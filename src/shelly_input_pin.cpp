@@ -31,6 +31,24 @@ InputPin::InputPin(int id, int pin, int on_value, enum mgos_gpio_pull_type pull,
                     .long_press_duration_ms = kDefaultLongPressDurationMs}) {
 }
 
+// Every sequence starts with a press. A press shorter than
+// short_press_duration_ms may be followed by another one, up to kMaxPresses.
+// Presses held longer than long_press_duration_ms become a long press.
+// Anything not in the table is ignored.
+// clang-format off
+const InputPin::Transition InputPin::kTransitions[] = {
+    {State::kIdle, Trigger::kOn, State::kPressed, Action::kPress},
+    {State::kReleased, Trigger::kOn, State::kPressed, Action::kPress},
+    {State::kPressed, Trigger::kOff, State::kReleased, Action::kRelease},
+    {State::kReleased, Trigger::kTimeout, State::kIdle, Action::kEmitPresses},
+    {State::kPressed, Trigger::kTimeout, State::kHeld, Action::kHold},
+    {State::kHeld, Trigger::kOff, State::kIdle, Action::kEmitPresses},
+    {State::kHeld, Trigger::kTimeout, State::kLongHeld, Action::kLong},
+    {State::kLongHeld, Trigger::kTimeout, State::kLongHeld, Action::kRepeat},
+    {State::kLongHeld, Trigger::kOff, State::kIdle, Action::kLongRelease},
+};
+// clang-format on
+
 InputPin::InputPin(int id, const Config &cfg)
     : Input(id), cfg_(cfg), timer_(std::bind(&InputPin::HandleTimer, this)) {
 }
@@ -49,6 +67,10 @@ void InputPin::SetInvert(bool invert) {
   GetState();
 }
 
+void InputPin::SetHoldRepeatMs(int interval_ms) {
+  hold_repeat_ms_ = interval_ms;
+}
+
 InputPin::~InputPin() {
   mgos_gpio_remove_int_handler(cfg_.pin, nullptr, nullptr);
 }
@@ -87,70 +109,81 @@ void InputPin::HandleGPIOInt() {
   if (cur_state == last_state) return;  // Noise
   LOG(LL_DEBUG, ("Input %d: %s (%d), st %d", id(), OnOff(cur_state),
                  mgos_gpio_read(cfg_.pin), (int) state_));
-  CallHandlers(Event::kChange, cur_state);
+  int64_t ts = mgos_uptime_micros();
+  CallHandlers(Event::kChange, cur_state, ts);
   double now = mgos_uptime();
   DetectReset(now, cur_state);
-  switch (state_) {
-    case State::kIdle:
-      if (cur_state) {
-        timer_.Reset(cfg_.short_press_duration_ms, 0);
-        state_ = State::kWaitOffSingle;
-        timer_cnt_ = 0;
-      }
-      break;
-    case State::kWaitOffSingle:
-      if (!cur_state) {
-        state_ = State::kWaitOnDouble;
-      }
+  HandleTrigger((cur_state ? Trigger::kOn : Trigger::kOff), cur_state, ts);
+  last_change_ts_ = now;
+}
+
+void InputPin::HandleTimer() {
+  bool cur_state = GetState();
+  LOG(LL_DEBUG, ("Input %d: timer, st %d", id(), (int) state_));
+  HandleTrigger(Trigger::kTimeout, cur_state, mgos_uptime_micros());
+}
+
+void InputPin::HandleTrigger(Trigger trigger, bool cur_state, int64_t ts) {
+  const Transition *t = nullptr;
+  for (const Transition &tt : kTransitions) {
+    if (tt.state == state_ && tt.trigger == trigger) {
+      t = &tt;
       break;
-    case State::kWaitOnDouble:
-      if (cur_state) {
-        timer_.Reset(cfg_.short_press_duration_ms, 0);
-        state_ = State::kWaitOffDouble;
-        timer_cnt_ = 0;
-      }
+    }
+  }
+  if (t == nullptr) return;
+  state_ = t->next_state;
+  switch (t->action) {
+    case Action::kPress:
+      num_presses_++;
+      timer_.Reset(cfg_.short_press_duration_ms, 0);
       break;
-    case State::kWaitOffDouble:
-      if (!cur_state) {
+    case Action::kRelease:
+      // Timer keeps running from the press.
+      if (num_presses_ >= kMaxPresses) {
+        // Can't get any longer, no need to wait.
         timer_.Clear();
-        CallHandlers(Event::kDouble, cur_state);
+        EmitPresses(cur_state, ts);
         state_ = State::kIdle;
       }
       break;
-    case State::kWaitOffLong:
-      if (!cur_state) {
-        timer_.Clear();
-        if (timer_cnt_ == 1) {
-          CallHandlers(Event::kSingle, cur_state);
-        }
-        state_ = State::kIdle;
-      }
+    case Action::kHold:
+      timer_.Reset(cfg_.long_press_duration_ms - cfg_.short_press_duration_ms,
+                   0);
+      break;
+    case Action::kLong:
+      num_presses_ = 0;
+      CallHandlers(Event::kLong, cur_state, ts);
+      if (hold_repeat_ms_ > 0) timer_.Reset(hold_repeat_ms_, 0);
+      break;
+    case Action::kRepeat:
+      CallHandlers(Event::kHoldRepeat, cur_state, ts);
+      // May have been disabled by the handler.
+      if (hold_repeat_ms_ > 0) timer_.Reset(hold_repeat_ms_, 0);
+      break;
+    case Action::kLongRelease:
+      timer_.Clear();
+      CallHandlers(Event::kLongRelease, cur_state, ts);
+      break;
+    case Action::kEmitPresses:
+      timer_.Clear();
+      EmitPresses(cur_state, ts);
       break;
   }
-  last_change_ts_ = now;
 }
 
-void InputPin::HandleTimer() {
-  timer_cnt_++;
-  bool cur_state = GetState();
-  LOG(LL_DEBUG, ("Input %d: timer, st %d", id(), (int) state_));
-  switch (state_) {
-    case State::kIdle:
+void InputPin::EmitPresses(bool cur_state, int64_t ts) {
+  int n = num_presses_;
+  num_presses_ = 0;
+  switch (n) {
+    case 1:
+      CallHandlers(Event::kSingle, cur_state, ts);
       break;
-    case State::kWaitOffSingle:
-    case State::kWaitOffDouble:
-      timer_.Reset(cfg_.long_press_duration_ms - cfg_.short_press_duration_ms,
-                   0);
-      state_ = State::kWaitOffLong;
+    case 2:
+      CallHandlers(Event::kDouble, cur_state, ts);
       break;
-    case State::kWaitOnDouble:
-      CallHandlers(Event::kSingle, cur_state);
-      state_ = State::kIdle;
-      break;
-    case State::kWaitOffLong:
-      if (timer_cnt_ == 2) {
-        CallHandlers(Event::kLong, cur_state);
-      }
+    case 3:
+      CallHandlers(Event::kTriple, cur_state, ts);
       break;
   }
 }
@@ -28,6 +28,8 @@ class InputPin : public Input {
  public:
   static constexpr int kDefaultShortPressDurationMs = 500;
   static constexpr int kDefaultLongPressDurationMs = 1000;
+  // Longest press sequence that is recognized (triple press).
+  static constexpr int kMaxPresses = 3;
 
   struct Config {
     int pin;
@@ -47,6 +49,7 @@ class InputPin : public Input {
   bool GetState() override;
   virtual void Init() override;
   void SetInvert(bool invert) override;
+  void SetHoldRepeatMs(int interval_ms) override;
 
  protected:
   virtual bool ReadPin();
@@ -56,26 +59,55 @@ class InputPin : public Input {
   bool invert_ = false;
 
  private:
+  // Gesture recognizer, driven by the transition table below.
   enum class State {
     kIdle = 0,
-    kWaitOffSingle = 1,
-    kWaitOnDouble = 2,
-    kWaitOffDouble = 3,
-    kWaitOffLong = 4,
+    kPressed = 1,   // Pressed, not yet for long.
+    kReleased = 2,  // Released after a short press, waiting for more.
+    kHeld = 3,      // Held past short press duration.
+    kLongHeld = 4,  // Long press reported, still held.
   };
 
+  enum class Trigger {
+    kOn = 0,
+    kOff = 1,
+    kTimeout = 2,
+  };
+
+  enum class Action {
+    kPress = 0,
+    kRelease = 1,
+    kHold = 2,
+    kLong = 3,
+    kRepeat = 4,
+    kLongRelease = 5,
+    kEmitPresses = 6,
+  };
+
+  struct Transition {
+    State state;
+    Trigger trigger;
+    State next_state;
+    Action action;
+  };
+
+  static const Transition kTransitions[];
+
   static void GPIOIntHandler(int pin, void *arg);
 
   void DetectReset(double now, bool cur_state);
 
   void HandleTimer();
+  void HandleTrigger(Trigger trigger, bool cur_state, int64_t ts);
+  void EmitPresses(bool cur_state, int64_t ts);
 
   bool last_state_ = false;
   int change_cnt_ = 0;         // State change counter for reset.
   double last_change_ts_ = 0;  // Timestamp of last change (uptime).
 
   State state_ = State::kIdle;
-  int timer_cnt_ = 0;
+  int num_presses_ = 0;
+  int hold_repeat_ms_ = 0;  // 0 - no hold repeat events.
   mgos::Timer timer_;
 
   InputPin(const InputPin &other) = delete;
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) Shelly-HomeKit Contributors
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shelly_light_color.hpp"
+
+#include <algorithm>
+
+namespace shelly {
+
+RGBW HSVToRGBW(int hue, int saturation, int brightness, bool extract_white) {
+  RGBW rgbw = {};
+  uint32_t v = brightness * kLightLevelMax / 100;
+
+  if (saturation == 0) {
+    // if saturation is zero than all rgb channels same as brightness
+    rgbw.r = rgbw.g = rgbw.b = v;
+  } else {
+    // otherwise calc rgb from hsv (hue, saturation, brightness)
+    uint32_t s = saturation * kLightLevelMax / 100;
+    int h = hue % 360;
+    int i = h / 60;
+    uint32_t f = (h % 60) * kLightLevelMax / 60;
+    LightLevel p = LightLevelMul(v, kLightLevelMax - s);
+    LightLevel q = LightLevelMul(v, kLightLevelMax - LightLevelMul(f, s));
+    LightLevel t =
+        LightLevelMul(v, kLightLevelMax - LightLevelMul(kLightLevelMax - f, s));
+
+    switch (i) {
+      case 0:  // 0° ≤ h < 60°
+        rgbw.r = v;
+        rgbw.g = t;
+        rgbw.b = p;
+        break;
+
+      case 1:  // 60° ≤ h < 120°
+        rgbw.r = q;
+        rgbw.g = v;
+        rgbw.b = p;
+        break;
+
+      case 2:  // 120° ≤ h < 180°
+        rgbw.r = p;
+        rgbw.g = v;
+        rgbw.b = t;
+        break;
+
+      case 3:  // 180° ≤ h < 240°
+        rgbw.r = p;
+        rgbw.g = q;
+        rgbw.b = v;
+        break;
+
+      case 4:  // 240° ≤ h < 300°
+        rgbw.r = t;
+        rgbw.g = p;
+        rgbw.b = v;
+        break;
+
+      case 5:  // 300° ≤ h < 360°
+        rgbw.r = v;
+        rgbw.g = p;
+        rgbw.b = q;
+        break;
+    }
+  }
+
+  if (extract_white) {
+    // apply white channel to rgb if available
+    rgbw.w = std::min(rgbw.r, std::min(rgbw.g, rgbw.b));
+    rgbw.r = rgbw.r - rgbw.w;
+    rgbw.g = rgbw.g - rgbw.w;
+    rgbw.b = rgbw.b - rgbw.w;
+  } else {
+    // otherwise turn white channel off
+    rgbw.w = 0;
+  }
+  return rgbw;
+}
+
+}  // namespace shelly
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) Shelly-HomeKit Contributors
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "shelly_light_curve.hpp"
+
+namespace shelly {
+
+struct RGBW {
+  LightLevel r;
+  LightLevel g;
+  LightLevel b;
+  LightLevel w;
+};
+
+// Product of two levels, both must be <= kLightLevelMax.
+inline LightLevel LightLevelMul(uint32_t a, uint32_t b) {
+  return (a * b) >> 15;
+}
+
+// Level between a and b, alpha is progress from a to b in Q15.
+inline LightLevel LightLevelLerp(LightLevel a, LightLevel b, uint32_t alpha) {
+  if (a == b) return a;
+  return (a < b ? a + LightLevelMul(b - a, alpha)
+                : a - LightLevelMul(a - b, alpha));
+}
+
+// Hue is in degrees, saturation and brightness are 0 - 100.
+// If extract_white is set, the part common to R, G and B goes to W,
+// otherwise W is off.
+RGBW HSVToRGBW(int hue, int saturation, int brightness, bool extract_white);
+
+}  // namespace shelly
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) Shelly-HomeKit Contributors
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shelly_light_curve.hpp"
+
+namespace shelly {
+
+namespace {
+
+constexpr int kCurveSize = (1 << LIGHT_CURVE_BITS) + 1;
+constexpr double kGamma = 2.2;
+constexpr double kLn2 = 0.69314718055994530942;
+
+// Tables are generated by recursive templates, keep within instantiation depth.
+static_assert(LIGHT_CURVE_BITS >= 2 && LIGHT_CURVE_BITS <= 9,
+              "LIGHT_CURVE_BITS must be between 2 and 9");
+
+// Compile-time math, C++11 constexpr only allows a single return statement.
+
+constexpr double Sq(double x) {
+  return x * x;
+}
+
+constexpr double ExpSeries(double x, double term, int n) {
+  return (n > 20 ? term : term + ExpSeries(x, term * x / n, n + 1));
+}
+
+// e^x, x <= 0. Halve the argument until the series converges quickly.
+constexpr double Exp(double x) {
+  return (x < -1 ? Sq(Exp(x / 2)) : ExpSeries(x, 1.0, 1));
+}
+
+constexpr double LnSeries(double y, double yn, int n) {
+  return (n > 41 ? 0 : yn / n + LnSeries(y, yn * y * y, n + 2));
+}
+
+// ln(x), 0 < x <= 1. Scale into [0.5, 1] first, series converges fast there.
+constexpr double Ln(double x) {
+  return (x < 0.5 ? Ln(x * 2) - kLn2
+                  : 2 * LnSeries((x - 1) / (x + 1), (x - 1) / (x + 1), 1));
+}
+
+constexpr double Gamma(double x) {
+  return (x <= 0 ? 0 : Exp(kGamma * Ln(x)));
+}
+
+// Relative luminance for lightness x (L* / 100).
+constexpr double CIE1931(double x) {
+  return (x <= 0.08 ? x * 100 / 903.3 : Sq((x * 100 + 16) / 116) *
+                                            ((x * 100 + 16) / 116));
+}
+
+constexpr LightLevel ToFixed(double v) {
+  return static_cast<LightLevel>(v * kLightLevelMax + 0.5);
+}
+
+constexpr double Point(int i) {
+  return static_cast<double>(i) / (kCurveSize - 1);
+}
+
+struct CurveTable {
+  LightLevel v[kCurveSize];
+};
+
+template <int... Is>
+struct Seq {};
+
+template <int N, int... Is>
+struct MakeSeq : MakeSeq<N - 1, N - 1, Is...> {};
+
+template <int... Is>
+struct MakeSeq<0, Is...> {
+  typedef Seq<Is...> type;
+};
+
+template <int... Is>
+constexpr CurveTable MakeGammaTable(Seq<Is...>) {
+  return {{ToFixed(Gamma(Point(Is)))...}};
+}
+
+template <int... Is>
+constexpr CurveTable MakeCIE1931Table(Seq<Is...>) {
+  return {{ToFixed(CIE1931(Point(Is)))...}};
+}
+
+constexpr CurveTable kGammaTable =
+    MakeGammaTable(MakeSeq<kCurveSize>::type());
+constexpr CurveTable kCIE1931Table =
+    MakeCIE1931Table(MakeSeq<kCurveSize>::type());
+
+static_assert(kGammaTable.v[0] == 0 &&
+                  kGammaTable.v[kCurveSize - 1] == kLightLevelMax,
+              "Bad gamma table");
+static_assert(kCIE1931Table.v[0] == 0 &&
+                  kCIE1931Table.v[kCurveSize - 1] == kLightLevelMax,
+              "Bad CIE 1931 table");
+
+LightLevel Lookup(const CurveTable &t, LightLevel level) {
+  // Position in the table, 8 fractional bits.
+  uint32_t pos = (static_cast<uint32_t>(level) * (kCurveSize - 1)) >> 7;
+  uint32_t i = pos >> 8, frac = pos & 0xff;
+  if (i >= kCurveSize - 1) return t.v[kCurveSize - 1];
+  uint32_t v1 = t.v[i], v2 = t.v[i + 1];
+  return v1 + (((v2 - v1) * frac) >> 8);
+}
+
+}  // namespace
+
+LightLevel ApplyLightCurve(LightCurve curve, LightLevel level) {
+  if (level >= kLightLevelMax) return kLightLevelMax;
+  switch (curve) {
+    case LightCurve::kGamma:
+      return Lookup(kGammaTable, level);
+    case LightCurve::kCIE1931:
+      return Lookup(kCIE1931Table, level);
+    case LightCurve::kLinear:
+    case LightCurve::kMax:
+    default:
+      return level;
+  }
+}
+
+}  // namespace shelly
@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) Shelly-HomeKit Contributors
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#ifndef LIGHT_CURVE_BITS
+#define LIGHT_CURVE_BITS 7
+#endif
+
+namespace shelly {
+
+// Fixed point light level, Q15: 0 is off, kLightLevelMax is full on.
+typedef uint16_t LightLevel;
+constexpr LightLevel kLightLevelMax = (1 << 15);
+
+// Perceptual correction applied to PWM duty before it is sent to an output.
+// Curves are stored as fixed point lookup tables of 2^LIGHT_CURVE_BITS + 1
+// entries computed at compile time, values in between are interpolated.
+enum class LightCurve {
+  kLinear = 0,
+  kGamma = 1,    // Gamma 2.2.
+  kCIE1931 = 2,  // CIE 1931 lightness.
+  kMax,
+};
+
+// Maps linear level to corrected level.
+LightLevel ApplyLightCurve(LightCurve curve, LightLevel level);
+
+}  // namespace shelly
@@ -47,6 +47,7 @@ extern "C" {
 #include "HAPPlatformServiceDiscovery+Init.h"
 #include "HAPPlatformTCPStreamManager+Init.h"
 
+#include "shelly_config_saver.hpp"
 #include "shelly_debug.hpp"
 #include "shelly_hap_input.hpp"
 #include "shelly_hap_lock.hpp"
@@ -58,6 +59,7 @@ extern "C" {
 #include "shelly_noisy_input_pin.hpp"
 #include "shelly_output.hpp"
 #include "shelly_rpc_service.hpp"
+#include "shelly_state_journal.hpp"
 #include "shelly_switch.hpp"
 #include "shelly_temp_sensor.hpp"
 
@@ -157,21 +159,75 @@ static std::unique_ptr<TempSensor> s_sys_temp_sensor;
 static bool s_failsafe_mode = false;
 std::vector<std::unique_ptr<Component>> g_comps;
 
+// Lookup indices, element at position N is the object with id N.
+static std::vector<Input *> s_inputs_idx;
+static std::vector<Output *> s_outputs_idx;
+static std::vector<PowerMeter *> s_pms_idx;
+static std::vector<Component *> s_comps_idx[(int) Component::Type::kMax];
+// Components of each type, in order of creation.
+static std::vector<Component *> s_comps_by_type[(int) Component::Type::kMax];
+
+template <class T, class TP>
+static void AddToIndex(std::vector<T *> *idx, int id, TP *v) {
+  if (id < 0) return;
+  if ((int) idx->size() <= id) idx->resize(id + 1);
+  (*idx)[id] = v;
+}
+
 template <class T>
-T *FindById(const std::vector<std::unique_ptr<T>> &vv, int id) {
+static void BuildIndex(const std::vector<std::unique_ptr<T>> &vv,
+                       std::vector<T *> *idx) {
+  idx->clear();
   for (auto &v : vv) {
-    if (v->id() == id) return v.get();
+    AddToIndex(idx, v->id(), v.get());
+  }
+  idx->shrink_to_fit();
+}
+
+template <class T>
+static T *FindById(const std::vector<T *> &idx, int id) {
+  if (id < 0 || id >= (int) idx.size()) return nullptr;
+  return idx[id];
+}
+
+static void BuildPeripheralIndex() {
+  BuildIndex(s_inputs, &s_inputs_idx);
+  BuildIndex(s_outputs, &s_outputs_idx);
+  BuildIndex(s_pms, &s_pms_idx);
+}
+
+static void BuildComponentIndex() {
+  for (int i = 0; i < (int) Component::Type::kMax; i++) {
+    s_comps_idx[i].clear();
+    s_comps_by_type[i].clear();
+  }
+  for (auto &c : g_comps) {
+    int type = (int) c->type();
+    if (type < 0 || type >= (int) Component::Type::kMax) continue;
+    AddToIndex(&s_comps_idx[type], c->id(), c.get());
+    s_comps_by_type[type].push_back(c.get());
   }
-  return nullptr;
 }
+
 Input *FindInput(int id) {
-  return FindById(s_inputs, id);
+  return FindById(s_inputs_idx, id);
 }
 Output *FindOutput(int id) {
-  return FindById(s_outputs, id);
+  return FindById(s_outputs_idx, id);
 }
 PowerMeter *FindPM(int id) {
-  return FindById(s_pms, id);
+  return FindById(s_pms_idx, id);
+}
+
+Component *FindComponent(Component::Type type, int id) {
+  if ((int) type < 0 || type >= Component::Type::kMax) return nullptr;
+  return FindById(s_comps_idx[(int) type], id);
+}
+
+const std::vector<Component *> &GetComponents(Component::Type type) {
+  static const std::vector<Component *> s_empty;
+  if ((int) type < 0 || type >= Component::Type::kMax) return s_empty;
+  return s_comps_by_type[(int) type];
 }
 
 // Executed very early, pretty much nothing is available here.
@@ -210,7 +266,7 @@ static void DoReset(void *arg) {
   mgos_sys_config_set_rpc_acl_file(nullptr);
   mgos_sys_config_set_rpc_auth_file(nullptr);
   mgos_sys_config_set_http_auth_file(nullptr);
-  if (mgos_sys_config_save(&mgos_sys_config, false, nullptr)) {
+  if (SaveConfig(nullptr /* msg */)) {
     remove(AUTH_FILE_NAME);
   }
 #ifdef MGOS_SYS_CONFIG_HAVE_WIFI
@@ -312,7 +368,7 @@ static void DisableLegacyHAPLayout() {
   if (!mgos_sys_config_get_shelly_legacy_hap_layout()) return;
   LOG(LL_INFO, ("Turning off legacy HAP layout"));
   mgos_sys_config_set_shelly_legacy_hap_layout(false);
-  mgos_sys_config_save(&mgos_sys_config, false /* try_once */, nullptr);
+  RequestConfigSave();
 }
 
 static bool StartService(bool quiet) {
@@ -340,6 +396,7 @@ static bool StartService(bool quiet) {
     CreateComponents(&g_comps, &s_accs, &s_server);
     s_accs.shrink_to_fit();
     g_comps.shrink_to_fit();
+    BuildComponentIndex();
   }
 
   if (!mgos_hap_config_valid()) {
@@ -394,6 +451,7 @@ static void HAPServerStateUpdateCB(HAPAccessoryServerRef *server, void *) {
     s_accs.clear();
     s_hap_accs.clear();
     g_comps.clear();
+    BuildComponentIndex();
   }
 }
 
@@ -558,7 +616,7 @@ static void StatusTimerCB(void *arg) {
     for (const auto &c : g_comps) {
       if (!status.empty()) status.append("; ");
       status.append(mgos::SPrintf("%d.%d: ", (int) c->type(), c->id()));
-      auto sts = c->GetInfo();
+      auto sts = c->GetCachedInfo();
       if (sts.ok()) {
         status.append(sts.ValueOrDie());
       } else {
@@ -690,8 +748,18 @@ static bool shelly_cfg_migrate(void) {
   return changed;
 }
 
+static void SaveEnergyCounters() {
+  for (auto &pm : s_pms) {
+    pm->SaveEnergy();
+  }
+}
+
 static void RebootCB(int ev, void *ev_data, void *userdata) {
   s_service_flags |= SHELLY_SERVICE_FLAG_REBOOT;
+  // Make sure pending changes are not lost.
+  SaveEnergyCounters();
+  StateJournalFlush();
+  FlushConfig();
   if (HAPAccessoryServerGetState(&s_server) ==
       kHAPAccessoryServerState_Running) {
     HAPAccessoryServerStop(&s_server);
@@ -726,18 +794,15 @@ static void ButtonHandler(Input::Event ev, bool cur_state) {
     }
     // Single press will toggle the switch, or cycle if there are two.
     case Input::Event::kSingle: {
+      TypedComponents<ShellySwitch> sws(Component::Type::kSwitch);
       uint32_t n = 0, i = 0, state = 0;
-      for (auto &c : g_comps) {
-        if (c->type() != Component::Type::kSwitch) continue;
-        const ShellySwitch *sw = static_cast<ShellySwitch *>(c.get());
+      for (const ShellySwitch *sw : sws) {
         if (sw->GetOutputState()) state |= (1 << n);
         n++;
       }
       if (n == 0) break;
       state++;
-      for (auto &c : g_comps) {
-        if (c->type() != Component::Type::kSwitch) continue;
-        ShellySwitch *sw = static_cast<ShellySwitch *>(c.get());
+      for (ShellySwitch *sw : sws) {
         bool new_state = (state & (1 << i));
         sw->SetOutputState(new_state, "btn");
         i++;
@@ -810,6 +875,9 @@ static void OTABeginCB(int ev, void *ev_data, void *userdata) {
       return;
     }
   }
+  SaveEnergyCounters();
+  StateJournalFlush();
+  FlushConfig();
   LOG(LL_INFO, ("Starting firmware update"));
   (void) ev;
   (void) ev_data;
@@ -862,6 +930,7 @@ bool WipeDevice() {
       "conf9.json",
       KVS_FILE_NAME,
       AUTH_FILE_NAME,
+      STATE_JOURNAL_FILE_NAME,
   };
   bool wiped = false;
   for (const char *wipe_fn : s_wipe_files) {
@@ -952,12 +1021,17 @@ void InitApp() {
                            &s_callbacks, nullptr /* context */);
 
   if (shelly_cfg_migrate()) {
-    mgos_sys_config_save(&mgos_sys_config, false /* try_once */,
-                         nullptr /* msg */);
+    SaveConfig(nullptr /* msg */);
+  }
+
+  const auto &sjst = StateJournalInit();
+  if (!sjst.ok()) {
+    LOG(LL_ERROR, ("State journal init failed: %s", sjst.ToString().c_str()));
   }
 
   LOG(LL_INFO, ("=== Creating peripherals"));
   CreatePeripherals(&s_inputs, &s_outputs, &s_pms, &s_sys_temp_sensor);
+  BuildPeripheralIndex();
 
   StartService(false /* quiet */);
 
@@ -43,6 +43,53 @@ Input *FindInput(int id);
 Output *FindOutput(int id);
 PowerMeter *FindPM(int id);
 
+// Component registry, rebuilt every time components are (re)created.
+Component *FindComponent(Component::Type type, int id);
+// Components of the specified type, in order of creation.
+const std::vector<Component *> &GetComponents(Component::Type type);
+
+// Iterates over components of a given type as instances of T,
+// for (ShellySwitch *sw : TypedComponents<ShellySwitch>(Type::kSwitch)).
+// T must be the class that implements components of this type.
+template <class T>
+class TypedComponents {
+ public:
+  class Iterator {
+   public:
+    explicit Iterator(std::vector<Component *>::const_iterator it) : it_(it) {
+    }
+    T *operator*() const {
+      return static_cast<T *>(*it_);
+    }
+    Iterator &operator++() {
+      ++it_;
+      return *this;
+    }
+    bool operator!=(const Iterator &other) const {
+      return it_ != other.it_;
+    }
+
+   private:
+    std::vector<Component *>::const_iterator it_;
+  };
+
+  explicit TypedComponents(Component::Type type)
+      : comps_(GetComponents(type)) {
+  }
+  Iterator begin() const {
+    return Iterator(comps_.begin());
+  }
+  Iterator end() const {
+    return Iterator(comps_.end());
+  }
+  size_t size() const {
+    return comps_.size();
+  }
+
+ private:
+  const std::vector<Component *> &comps_;
+};
+
 void CreateHAPSwitch(int id, const struct mgos_config_sw *sw_cfg,
                      const struct mgos_config_in *in_cfg,
                      std::vector<std::unique_ptr<Component>> *comps,
@@ -23,6 +23,10 @@
 
 namespace shelly {
 
+#define PWM_FREQ 400
+// PWM duty is set with 1 us granularity.
+#define PWM_STEPS (1000000 / PWM_FREQ)
+
 Output::Output(int id) : id_(id) {
 }
 
@@ -57,6 +61,7 @@ int OutputPin::pin() const {
 Status OutputPin::SetState(bool on, const char *source) {
   bool cur_state = GetState();
   mgos_gpio_write(pin_, ((on ^ out_invert_) ? on_value_ : !on_value_));
+  pwm_duty_ = -1;
   pulse_active_ = false;
   if (on == cur_state) return Status::OK();
   if (source == nullptr) source = "";
@@ -66,8 +71,15 @@ Status OutputPin::SetState(bool on, const char *source) {
 }
 
 Status OutputPin::SetStatePWM(float duty, const char *source) {
-  if (duty != 0) {
-    mgos_pwm_set(pin_, 400, duty);
+  int q = static_cast<int>(duty * PWM_STEPS + 0.5f);
+  if (q < 0) q = 0;
+  if (q > PWM_STEPS) q = PWM_STEPS;
+  // Nothing to do if the change is not visible at PWM resolution.
+  if (q == pwm_duty_) return Status::OK();
+  pwm_duty_ = q;
+  if (q != 0) {
+    duty = static_cast<float>(q) / PWM_STEPS;
+    mgos_pwm_set(pin_, PWM_FREQ, duty);
     LOG(LL_DEBUG, ("Output %d: %f (%s)", id(), duty, source));
   } else {
     mgos_pwm_set(pin_, 0, 0);
@@ -76,6 +88,10 @@ Status OutputPin::SetStatePWM(float duty, const char *source) {
   return Status::OK();
 }
 
+int OutputPin::GetPWMSteps() const {
+  return PWM_STEPS;
+}
+
 Status OutputPin::Pulse(bool on, int duration_ms, const char *source) {
   Status st = SetState(on, source);
   if (!st.ok()) return st;
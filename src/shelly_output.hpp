@@ -32,6 +32,8 @@ class Output {
   virtual bool GetState() = 0;
   virtual Status SetState(bool on, const char *source) = 0;
   virtual Status SetStatePWM(float duty, const char *source) = 0;
+  // Number of distinct non-zero duty values SetStatePWM can produce.
+  virtual int GetPWMSteps() const = 0;
   virtual Status Pulse(bool on, int duration_ms, const char *source) = 0;
   virtual void SetInvert(bool out_invert) = 0;
 
@@ -49,6 +51,7 @@ class OutputPin : public Output {
   bool GetState() override;
   Status SetState(bool on, const char *source) override;
   Status SetStatePWM(float duty, const char *source) override;
+  int GetPWMSteps() const override;
   Status Pulse(bool on, int duration_ms, const char *source) override;
   int pin() const;
   void SetInvert(bool out_invert) override;
@@ -62,6 +65,9 @@ class OutputPin : public Output {
   const int pin_;
   const int on_value_;
 
+  // Quantized duty currently set, -1 if the pin is not in PWM mode.
+  int pwm_duty_ = -1;
+
   bool pulse_active_ = false;
   mgos::Timer pulse_timer_;
 
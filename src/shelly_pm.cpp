@@ -17,9 +17,26 @@
 
 #include "shelly_pm.hpp"
 
+#include <algorithm>
+#include <cmath>
+
+#include "mgos.hpp"
+#include "mgos_sys_config.h"
+
+#include "shelly_state_journal.hpp"
+
 namespace shelly {
 
+constexpr PowerMeter::HandlerID PowerMeter::kInvalidHandlerID;
+
 PowerMeter::PowerMeter(int id) : id_(id) {
+  int32_t lo = 0, hi = 0;
+  if (StateJournalGetPM(id, StateKey::kEnergyLo, &lo) &&
+      StateJournalGetPM(id, StateKey::kEnergyHi, &hi)) {
+    aea_mwh_ = (((uint64_t) (uint32_t) hi) << 32) | (uint32_t) lo;
+    saved_aea_mwh_ = aea_mwh_;
+  }
+  last_save_ = mgos_uptime_micros();
 }
 
 PowerMeter::~PowerMeter() {
@@ -29,4 +46,120 @@ int PowerMeter::id() const {
   return id_;
 }
 
+const PowerHistory *PowerMeter::GetHistory() const {
+  return history_.get();
+}
+
+PowerMeter::HandlerID PowerMeter::AddHandler(HandlerFn h) {
+  int i;
+  for (i = 0; i < (int) handlers_.size(); i++) {
+    if (handlers_[i] == nullptr) {
+      handlers_[i] = h;
+      return i;
+    }
+  }
+  handlers_.push_back(h);
+  return i;
+}
+
+void PowerMeter::RemoveHandler(HandlerID hi) {
+  if (hi < 0) return;
+  handlers_[hi] = nullptr;
+}
+
+void PowerMeter::CallHandlers(float w) {
+  for (auto &h : handlers_) {
+    if (h != nullptr) h(w);
+  }
+}
+
+StatusOr<float> PowerMeter::GetEnergyWH() {
+  return (aea_mwh_ + aea_frac_mwh_) / 1000.0f;
+}
+
+StatusOr<float> PowerMeter::GetVoltageV() {
+  return Status::UNIMPLEMENTED();
+}
+
+StatusOr<float> PowerMeter::GetCurrentA() {
+  return Status::UNIMPLEMENTED();
+}
+
+StatusOr<float> PowerMeter::GetApparentPowerVA() {
+  auto vv = GetVoltageV();
+  if (!vv.ok()) return vv.status();
+  auto iv = GetCurrentA();
+  if (!iv.ok()) return iv.status();
+  return vv.ValueOrDie() * iv.ValueOrDie();
+}
+
+StatusOr<float> PowerMeter::GetReactivePowerVAR() {
+  auto sv = GetApparentPowerVA();
+  if (!sv.ok()) return sv.status();
+  auto pv = GetPowerW();
+  if (!pv.ok()) return pv.status();
+  float s = sv.ValueOrDie(), p = pv.ValueOrDie();
+  // Readings are not simultaneous, S can end up slightly below P.
+  return (s > p ? std::sqrt(s * s - p * p) : 0.0f);
+}
+
+StatusOr<float> PowerMeter::GetPowerFactor() {
+  auto sv = GetApparentPowerVA();
+  if (!sv.ok()) return sv.status();
+  auto pv = GetPowerW();
+  if (!pv.ok()) return pv.status();
+  float s = sv.ValueOrDie(), p = pv.ValueOrDie();
+  if (s < 1) return 0.0f;  // No load.
+  return std::min(p / s, 1.0f);
+}
+
+void PowerMeter::SetFastSampling(bool fast) {
+  (void) fast;
+}
+
+uint64_t PowerMeter::GetEnergyMWh() const {
+  return aea_mwh_;
+}
+
+void PowerMeter::ResetEnergy() {
+  LOG(LL_INFO, ("PM %d: Energy reset", id()));
+  SetEnergyMWh(0);
+  SaveEnergy();
+  StateJournalFlush();
+}
+
+void PowerMeter::SaveEnergy() {
+  last_save_ = mgos_uptime_micros();
+  if (aea_mwh_ == saved_aea_mwh_) return;
+  StateJournalPutPM(id(), StateKey::kEnergyLo, (int32_t) aea_mwh_);
+  StateJournalPutPM(id(), StateKey::kEnergyHi, (int32_t) (aea_mwh_ >> 32));
+  saved_aea_mwh_ = aea_mwh_;
+}
+
+void PowerMeter::AddEnergyWH(float wh) {
+  if (wh > 0) {
+    // Accumulate whole milliwatt-hours, carry over the remainder.
+    aea_frac_mwh_ += wh * 1000;
+    float whole = std::floor(aea_frac_mwh_);
+    aea_mwh_ += (uint64_t) whole;
+    aea_frac_mwh_ -= whole;
+  }
+  int64_t save_interval_us =
+      mgos_sys_config_get_shelly_energy_save_interval() * 1000000LL;
+  if (mgos_uptime_micros() - last_save_ >= save_interval_us) {
+    SaveEnergy();
+  }
+}
+
+void PowerMeter::SetEnergyMWh(uint64_t mwh) {
+  aea_mwh_ = mwh;
+  aea_frac_mwh_ = 0;
+}
+
+void PowerMeter::RecordPower(float w, int duration_ms) {
+  // Allocated on first use, meters that do not record history don't pay.
+  if (history_ == nullptr) history_.reset(new PowerHistory());
+  history_->AddSample(w, duration_ms);
+}
+
 }  // namespace shelly
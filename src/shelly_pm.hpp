@@ -17,10 +17,12 @@
 
 #pragma once
 
+#include <functional>
 #include <memory>
 #include <vector>
 
 #include "shelly_common.hpp"
+#include "shelly_pm_history.hpp"
 
 namespace shelly {
 
@@ -33,10 +35,54 @@ class PowerMeter {
 
   virtual Status Init() = 0;
   virtual StatusOr<float> GetPowerW() = 0;
-  virtual StatusOr<float> GetEnergyWH() = 0;
+  virtual StatusOr<float> GetEnergyWH();
+
+  // Extended measurements, not supported by all meters.
+  virtual StatusOr<float> GetVoltageV();
+  virtual StatusOr<float> GetCurrentA();
+  // Derived from voltage and current by default.
+  virtual StatusOr<float> GetApparentPowerVA();
+  virtual StatusOr<float> GetReactivePowerVAR();
+  virtual StatusOr<float> GetPowerFactor();
+
+  // Hint that power readings are needed more often than usual,
+  // e.g. while a motor is running. Not all meters make use of it.
+  virtual void SetFastSampling(bool fast);
+
+  // Total accumulated energy, persisted across reboots.
+  uint64_t GetEnergyMWh() const;
+  void ResetEnergy();
+  // Save the energy counter if changed. Done periodically, but should also
+  // be invoked before reboot.
+  void SaveEnergy();
+
+  // Returns nullptr if no measurements have been recorded yet.
+  const PowerHistory *GetHistory() const;
+
+  // Handlers are invoked with every new active power reading,
+  // from the meter's sampling timer.
+  typedef int HandlerID;
+  static constexpr HandlerID kInvalidHandlerID = -1;
+  typedef std::function<void(float w)> HandlerFn;
+  HandlerID AddHandler(HandlerFn h);
+  void RemoveHandler(HandlerID hi);
+
+ protected:
+  // To be called by implementations after every sample.
+  void CallHandlers(float w);
+  // To be called by implementations after every measurement cycle.
+  void RecordPower(float w, int duration_ms);
+  void AddEnergyWH(float wh);
+  void SetEnergyMWh(uint64_t mwh);
 
  private:
   const int id_;
+  std::unique_ptr<PowerHistory> history_;
+  std::vector<HandlerFn> handlers_;
+  uint64_t aea_mwh_ = 0;    // Accumulated active energy, mWh.
+  float aea_frac_mwh_ = 0;  // Fractional part, not yet accounted for.
+  uint64_t saved_aea_mwh_ = 0;
+  int64_t last_save_ = 0;
 
   PowerMeter(const PowerMeter &other) = delete;
 };
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) Shelly-HomeKit Contributors
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shelly_pm_history.hpp"
+
+#include <algorithm>
+
+#include "mgos.hpp"
+
+namespace shelly {
+
+void PowerHistory::AddSample(float w, int duration_ms) {
+  // Spread the sample over per-second buckets.
+  while (duration_ms > 0) {
+    int n = std::min(duration_ms, 1000 - sec_acc_ms_);
+    sec_acc_ += w * n;
+    sec_acc_ms_ += n;
+    duration_ms -= n;
+    if (sec_acc_ms_ == 1000) {
+      PushSecond(sec_acc_ / 1000);
+      sec_acc_ = 0;
+      sec_acc_ms_ = 0;
+    }
+  }
+}
+
+void PowerHistory::PushSecond(float w) {
+  secs_.Push(Encode(w));
+  last_ts_[(int) Tier::kSecond] = mgos_uptime();
+  min_acc_ += w;
+  if (++min_num_ < 60) return;
+  PushMinute(min_acc_ / min_num_);
+  min_acc_ = 0;
+  min_num_ = 0;
+}
+
+void PowerHistory::PushMinute(float w) {
+  mins_.Push(Encode(w));
+  last_ts_[(int) Tier::kMinute] = mgos_uptime();
+  hour_acc_ += w;
+  if (++hour_num_ < 60) return;
+  hours_.Push(Encode(hour_acc_ / hour_num_));
+  last_ts_[(int) Tier::kHour] = mgos_uptime();
+  hour_acc_ = 0;
+  hour_num_ = 0;
+}
+
+// static
+int PowerHistory::GetInterval(Tier tier) {
+  switch (tier) {
+    case Tier::kSecond:
+      return 1;
+    case Tier::kMinute:
+      return 60;
+    case Tier::kHour:
+      return 3600;
+  }
+  return 0;
+}
+
+int PowerHistory::GetSize(Tier tier) const {
+  switch (tier) {
+    case Tier::kSecond:
+      return secs_.size();
+    case Tier::kMinute:
+      return mins_.size();
+    case Tier::kHour:
+      return hours_.size();
+  }
+  return 0;
+}
+
+uint16_t PowerHistory::GetSample(Tier tier, int i) const {
+  switch (tier) {
+    case Tier::kSecond:
+      return secs_.at(i);
+    case Tier::kMinute:
+      return mins_.at(i);
+    case Tier::kHour:
+      return hours_.at(i);
+  }
+  return 0;
+}
+
+double PowerHistory::GetLastSampleTime(Tier tier) const {
+  return last_ts_[(int) tier];
+}
+
+// static
+uint16_t PowerHistory::Encode(float w) {
+  float v = w / kScale + 0.5f;
+  if (v < 0) return 0;
+  if (v > UINT16_MAX) return UINT16_MAX;
+  return (uint16_t) v;
+}
+
+}  // namespace shelly
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) Shelly-HomeKit Contributors
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+namespace shelly {
+
+// Fixed-size ring buffer, oldest entries are overwritten when full.
+template <class T, int N>
+class RingBuffer {
+ public:
+  static constexpr int kCapacity = N;
+
+  void Push(T v) {
+    buf_[head_] = v;
+    head_ = (head_ + 1) % N;
+    if (size_ < N) size_++;
+  }
+  int size() const {
+    return size_;
+  }
+  // 0 is the oldest entry.
+  T at(int i) const {
+    return buf_[(head_ + N - size_ + i) % N];
+  }
+
+ private:
+  T buf_[N];
+  int head_ = 0;
+  int size_ = 0;
+};
+
+// Downsampled power history: per-second, per-minute and per-hour averages.
+// Values are stored in units of 0.1 W.
+class PowerHistory {
+ public:
+  enum class Tier {
+    kSecond = 0,
+    kMinute = 1,
+    kHour = 2,
+  };
+
+  static constexpr float kScale = 0.1;
+
+  // Adds average power over the last duration_ms.
+  void AddSample(float w, int duration_ms);
+
+  // Interval between samples of the tier, in seconds.
+  static int GetInterval(Tier tier);
+  int GetSize(Tier tier) const;
+  // 0 is the oldest sample.
+  uint16_t GetSample(Tier tier, int i) const;
+  // Uptime at which the newest sample of the tier was recorded.
+  double GetLastSampleTime(Tier tier) const;
+
+ private:
+  static uint16_t Encode(float w);
+
+  void PushSecond(float w);
+  void PushMinute(float w);
+
+  RingBuffer<uint16_t, 180> secs_;
+  RingBuffer<uint16_t, 1440> mins_;
+  RingBuffer<uint16_t, 168> hours_;
+
+  float sec_acc_ = 0;  // W * ms
+  int sec_acc_ms_ = 0;
+  float min_acc_ = 0;
+  int min_num_ = 0;
+  float hour_acc_ = 0;
+  int hour_num_ = 0;
+  double last_ts_[3] = {};
+};
+
+}  // namespace shelly
@@ -17,6 +17,9 @@
 
 #include "shelly_rpc_service.hpp"
 
+#include <map>
+#include <vector>
+
 #include "mgos.hpp"
 #include "mgos_dns_sd.h"
 #include "mgos_http_server.h"
@@ -24,6 +27,7 @@
 
 #include "HAPAccessoryServer+Internal.h"
 
+#include "shelly_config_saver.hpp"
 #include "shelly_debug.hpp"
 #include "shelly_hap_switch.hpp"
 #include "shelly_main.hpp"
@@ -61,9 +65,8 @@ static void GetInfoHandler(struct mg_rpc_request_info *ri, void *cb_arg,
   (void) args;
 }
 
-static void GetInfoExtHandler(struct mg_rpc_request_info *ri, void *cb_arg,
-                              struct mg_rpc_frame_info *fi,
-                              struct mg_str args) {
+// Everything except uptime and components, the object is left open.
+static std::string GetSysInfoJSON() {
   bool hap_paired = HAPAccessoryServerIsPaired(s_server);
   bool hap_running = (HAPAccessoryServerGetState(s_server) ==
                       kHAPAccessoryServerState_Running);
@@ -89,7 +92,7 @@ static void GetInfoExtHandler(struct mg_rpc_request_info *ri, void *cb_arg,
 #endif
   std::string res = mgos::JSONPrintStringf(
       "{device_id: %Q, name: %Q, app: %Q, model: %Q, stock_fw_model: %Q, "
-      "host: %Q, version: %Q, fw_build: %Q, uptime: %d, failsafe_mode: %B, "
+      "host: %Q, version: %Q, fw_build: %Q, failsafe_mode: %B, "
       "auth_en: %B, auth_domain: %Q, "
 #ifdef MGOS_HAVE_WIFI
       "wifi_en: %B, wifi_ssid: %Q, wifi_pass: %Q, "
@@ -103,7 +106,7 @@ static void GetInfoExtHandler(struct mg_rpc_request_info *ri, void *cb_arg,
       MGOS_APP, CS_STRINGIFY_MACRO(PRODUCT_MODEL),
       CS_STRINGIFY_MACRO(STOCK_FW_MODEL), mgos_dns_sd_get_host_name(),
       mgos_sys_ro_vars_get_fw_version(), mgos_sys_ro_vars_get_fw_id(),
-      (int) mgos_uptime(), false /* failsafe_mode */,
+      false /* failsafe_mode */,
       !mgos_conf_str_empty(mgos_sys_config_get_rpc_auth_file()), /* auth_en */
       mgos_sys_config_get_rpc_auth_domain(),
 #ifdef MGOS_HAVE_WIFI
@@ -132,74 +135,256 @@ static void GetInfoExtHandler(struct mg_rpc_request_info *ri, void *cb_arg,
                             sys_temp.ValueOrDie(),
                             (flags & SHELLY_SERVICE_FLAG_OVERHEAT));
   }
-  mgos::JSONAppendStringf(&res, ", components: [");
+  return res;
+}
+
+// Status subscribers.
+// Subscribers get a full snapshot in response to Shelly.Subscribe and then
+// Shelly.Status notifications with only the parts that changed since.
+// Components are only looked at when they invalidated their status or when
+// their status is allowed to change on its own and is old enough.
+// System info changes on its own (RSSI, temperature) and is checked rarely.
+// Uptime is not pushed, clients are expected to count it themselves.
+#define STATUS_MAX_SUBSCRIBERS 4
+#define STATUS_PUSH_INTERVAL_MS 1000
+#define STATUS_SYS_INFO_MAX_AGE_MS 10000
+
+struct PushedInfo {
+  std::string json;
+  uint32_t version = 0;
+  int64_t ts = 0;
+};
+
+static std::vector<std::string> s_subscribers;
+static mgos_timer_id s_status_timer_id = MGOS_INVALID_TIMER_ID;
+// Last pushed state: system info and component info keyed by (type, id).
+static PushedInfo s_last_sys_info;
+static bool s_sys_info_dirty = false;
+static std::map<std::pair<int, int>, PushedInfo> s_last_comp_info;
+static size_t s_last_num_comps = 0;
+
+// If seed_last is set, subscribers are assumed to have received the result.
+static std::string GetInfoExtJSON(bool seed_last = false) {
+  int64_t now = mgos_uptime_micros();
+  std::string sys_info = GetSysInfoJSON();
+  std::string res = sys_info;
+  mgos::JSONAppendStringf(&res, ", uptime: %d, components: [",
+                          (int) mgos_uptime());
+  if (seed_last) {
+    s_last_sys_info.json = sys_info;
+    s_last_sys_info.ts = now;
+    s_sys_info_dirty = false;
+    s_last_comp_info.clear();
+    s_last_num_comps = g_comps.size();
+  }
   bool first = true;
   for (const auto &c : g_comps) {
-    const auto &is = c->GetInfoJSON();
+    const auto &is = c->GetCachedInfoJSON();
     if (is.ok()) {
       if (!first) res.append(", ");
       res.append(is.ValueOrDie());
       first = false;
+      if (seed_last) {
+        PushedInfo &last = s_last_comp_info[std::make_pair((int) c->type(),
+                                                           c->id())];
+        last.json = is.ValueOrDie();
+        last.version = c->info_version();
+        last.ts = now;
+      }
     }
   }
 
   mgos::JSONAppendStringf(&res, "]}");
+  return res;
+}
 
-  mg_rpc_send_responsef(ri, "%s", res.c_str());
+static void GetInfoExtHandler(struct mg_rpc_request_info *ri, void *cb_arg,
+                              struct mg_rpc_frame_info *fi,
+                              struct mg_str args) {
+  mg_rpc_send_responsef(ri, "%s", GetInfoExtJSON().c_str());
 
   (void) cb_arg;
   (void) fi;
   (void) args;
 }
 
-static void SetConfigHandler(struct mg_rpc_request_info *ri, void *cb_arg,
-                             struct mg_rpc_frame_info *fi, struct mg_str args) {
-  int id = -1;
-  int type = -1;
-  struct json_token config_tok = JSON_INVALID_TOKEN;
+static void RemoveSubscriber(const struct mg_str &dst) {
+  for (auto it = s_subscribers.begin(); it != s_subscribers.end(); it++) {
+    if (mg_vcmp(&dst, it->c_str()) != 0) continue;
+    LOG(LL_INFO, ("Status subscriber %s removed", it->c_str()));
+    s_subscribers.erase(it);
+    break;
+  }
+  if (s_subscribers.empty()) {
+    mgos_clear_timer(s_status_timer_id);
+    s_status_timer_id = MGOS_INVALID_TIMER_ID;
+    s_last_sys_info = PushedInfo();
+    s_last_comp_info.clear();
+    s_last_num_comps = 0;
+  }
+}
 
-  json_scanf(args.p, args.len, ri->args_fmt, &id, &type, &config_tok);
+static void StatusPushTimerCB(void *arg) {
+  int64_t now = mgos_uptime_micros();
+  std::string res;
+  if (s_sys_info_dirty ||
+      now - s_last_sys_info.ts >= STATUS_SYS_INFO_MAX_AGE_MS * 1000) {
+    std::string sys_info = GetSysInfoJSON();
+    if (sys_info != s_last_sys_info.json) {
+      // Reuse the open object as the notification body.
+      res = sys_info;
+      s_last_sys_info.json = sys_info;
+    }
+    s_last_sys_info.ts = now;
+    s_sys_info_dirty = false;
+  }
+  std::string comps;
+  for (const auto &c : g_comps) {
+    auto key = std::make_pair((int) c->type(), c->id());
+    PushedInfo &last = s_last_comp_info[key];
+    int max_age_ms = c->GetInfoMaxAgeMs();
+    // InvalidateInfo() bumps the version, that is what marks it dirty.
+    bool dirty = (last.ts == 0 || c->info_version() != last.version ||
+                  (max_age_ms >= 0 && now - last.ts >= max_age_ms * 1000));
+    if (!dirty) continue;
+    const auto &is = c->GetCachedInfoJSON();
+    if (!is.ok()) continue;
+    const std::string &cs = is.ValueOrDie();
+    last.version = c->info_version();
+    last.ts = now;
+    if (cs == last.json) continue;
+    if (!comps.empty()) comps.append(", ");
+    comps.append(cs);
+    last.json = cs;
+  }
+  if (res.empty() && comps.empty() && g_comps.size() == s_last_num_comps) {
+    return;
+  }
+  s_last_num_comps = g_comps.size();
+  if (res.empty()) {
+    res = "{";
+  } else {
+    res.append(", ");
+  }
+  // Let the client detect added or removed components.
+  mgos::JSONAppendStringf(&res, "num_components: %d, components: [%s]}",
+                          (int) g_comps.size(), comps.c_str());
+  // Copy, list may be modified by RemoveSubscriber.
+  auto subscribers = s_subscribers;
+  for (const auto &dst : subscribers) {
+    struct mg_rpc_call_opts opts = {};
+    opts.dst = mg_mk_str(dst.c_str());
+    opts.no_queue = true;
+    if (!mg_rpc_callf(mgos_rpc_get_global(), mg_mk_str("Shelly.Status"),
+                      nullptr /* cb */, nullptr /* cb_arg */, &opts, "%s",
+                      res.c_str())) {
+      RemoveSubscriber(opts.dst);
+    }
+  }
+  (void) arg;
+}
 
-  if (config_tok.len == 0) {
-    mg_rpc_send_errorf(ri, 400, "%s is required", "config");
+static void RPCObserverCB(struct mg_rpc *c, void *cb_arg, enum mg_rpc_event ev,
+                          void *ev_arg) {
+  if (ev != MG_RPC_EV_CHANNEL_CLOSED) return;
+  RemoveSubscriber(*((const struct mg_str *) ev_arg));
+  (void) c;
+  (void) cb_arg;
+}
+
+static void SubscribeHandler(struct mg_rpc_request_info *ri, void *cb_arg,
+                             struct mg_rpc_frame_info *fi, struct mg_str args) {
+  if (ri->src.len == 0) {
+    mg_rpc_send_errorf(ri, 400, "%s is required", "src");
+    return;
+  }
+  bool found = false;
+  for (const auto &dst : s_subscribers) {
+    if (mg_vcmp(&ri->src, dst.c_str()) == 0) {
+      found = true;
+      break;
+    }
+  }
+  if (!found && s_subscribers.size() >= STATUS_MAX_SUBSCRIBERS) {
+    mg_rpc_send_errorf(ri, 429, "too many %s", "subscribers");
     return;
   }
+  // Everyone continues from the snapshot we are about to send,
+  // so flush pending changes to existing subscribers first.
+  if (!s_subscribers.empty()) StatusPushTimerCB(nullptr /* arg */);
+  if (!found) {
+    s_subscribers.emplace_back(ri->src.p, ri->src.len);
+    LOG(LL_INFO, ("Status subscriber %s added", s_subscribers.back().c_str()));
+  }
+  if (s_status_timer_id == MGOS_INVALID_TIMER_ID) {
+    s_status_timer_id =
+        mgos_set_timer(STATUS_PUSH_INTERVAL_MS, MGOS_TIMER_REPEAT,
+                       StatusPushTimerCB, nullptr /* arg */);
+  }
+  mg_rpc_send_responsef(ri, "%s", GetInfoExtJSON(true /* seed_last */).c_str());
+
+  (void) cb_arg;
+  (void) fi;
+  (void) args;
+}
+
+// Applies system (id = -1, type = -1) or component settings.
+// Config is not saved, restart_required is set if service needs a restart.
+struct SysSettings {
+  bool set_name = false;
+  std::string name;
+  int sys_mode = -1;
+  int debug_en = -1;
+};
+
+// Parses and validates system settings, nothing is applied.
+static Status ParseSysConfig(const struct json_token &config_tok,
+                             SysSettings *ss) {
+  char *name_c = nullptr;
+  int8_t debug_en = -1;
+  json_scanf(config_tok.ptr, config_tok.len,
+             "{name: %Q, sys_mode: %d, debug_en: %B}", &name_c, &ss->sys_mode,
+             &debug_en);
+  mgos::ScopedCPtr name_owner(name_c);
+  ss->debug_en = debug_en;
+  if (ss->sys_mode < -1 || ss->sys_mode > 4) {
+    return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "sys_mode");
+  }
+  if (name_c != nullptr) {
+    mgos_expand_mac_address_placeholders(name_c);
+    ss->name = name_c;
+    if (ss->name.length() > 64) {
+      return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "name");
+    }
+    for (char c : ss->name) {
+      if (!std::isalnum(c) && c != '-') {
+        return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "name");
+      }
+    }
+    ss->set_name = true;
+  }
+  return Status::OK();
+}
+
+static bool IsSysItem(int id, int type) {
+  return (id == -1 && type == -1);
+}
 
+static Status ApplyConfig(int id, int type, const struct json_token &config_tok,
+                          bool *restart_required) {
   Status st = Status::OK();
-  bool restart_required = false;
-  if (id == -1 && type == -1) {
+  if (IsSysItem(id, type)) {
     // System settings.
-    char *name_c = nullptr;
-    int sys_mode = -1;
-    int8_t debug_en = -1;
-    json_scanf(config_tok.ptr, config_tok.len,
-               "{name: %Q, sys_mode: %d, debug_en: %B}", &name_c, &sys_mode,
-               &debug_en);
-    mgos::ScopedCPtr name_owner(name_c);
-
-    if (sys_mode >= 0 && sys_mode <= 4) {
-      if (sys_mode != mgos_sys_config_get_shelly_mode()) {
-        mgos_sys_config_set_shelly_mode(sys_mode);
-        restart_required = true;
-      }
-    } else if (sys_mode == -1) {
-      // Nothing.
-    } else {
-      st = mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "sys_mode");
+    SysSettings ss;
+    st = ParseSysConfig(config_tok, &ss);
+    if (!st.ok()) return st;
+    if (ss.sys_mode >= 0 &&
+        ss.sys_mode != mgos_sys_config_get_shelly_mode()) {
+      mgos_sys_config_set_shelly_mode(ss.sys_mode);
+      *restart_required = true;
     }
-    if (name_c != nullptr) {
-      mgos_expand_mac_address_placeholders(name_c);
-      std::string name(name_c);
-      if (name.length() > 64) {
-        mg_rpc_send_errorf(ri, 400, "invalid %s", "name");
-        return;
-      }
-      for (char c : name) {
-        if (!std::isalnum(c) && c != '-') {
-          mg_rpc_send_errorf(ri, 400, "invalid %s", "name");
-          return;
-        }
-      }
+    if (ss.set_name) {
+      const std::string &name = ss.name;
       if (strcmp(mgos_sys_config_get_shelly_name(), name.c_str()) != 0) {
         LOG(LL_INFO, ("Name change: %s -> %s",
                       mgos_sys_config_get_shelly_name(), name.c_str()));
@@ -207,29 +392,44 @@ static void SetConfigHandler(struct mg_rpc_request_info *ri, void *cb_arg,
         mgos_sys_config_set_dns_sd_host_name(name.c_str());
         mgos_dns_sd_set_host_name(name.c_str());
         mgos_http_server_publish_dns_sd();
-        restart_required = true;
+        *restart_required = true;
       }
     }
-    if (debug_en != -1) {
-      SetDebugEnable(debug_en);
+    if (ss.debug_en != -1) {
+      SetDebugEnable(ss.debug_en);
     }
+    s_sys_info_dirty = true;
   } else {
     // Component settings.
-    bool found = false;
-    for (auto &c : g_comps) {
-      if (c->id() != id || (int) c->type() != type) continue;
+    Component *c = FindComponent((Component::Type) type, id);
+    if (c != nullptr) {
       st = c->SetConfig(std::string(config_tok.ptr, config_tok.len),
-                        &restart_required);
-      found = true;
-      break;
-    }
-    if (!found) {
+                        restart_required);
+    } else {
       st = mgos::Errorf(STATUS_INVALID_ARGUMENT, "component not found");
     }
   }
+  return st;
+}
+
+static void SetConfigHandler(struct mg_rpc_request_info *ri, void *cb_arg,
+                             struct mg_rpc_frame_info *fi, struct mg_str args) {
+  int id = -1;
+  int type = -1;
+  struct json_token config_tok = JSON_INVALID_TOKEN;
+
+  json_scanf(args.p, args.len, ri->args_fmt, &id, &type, &config_tok);
+
+  if (config_tok.len == 0) {
+    mg_rpc_send_errorf(ri, 400, "%s is required", "config");
+    return;
+  }
+
+  bool restart_required = false;
+  Status st = ApplyConfig(id, type, config_tok, &restart_required);
   if (st.ok()) {
     LOG(LL_ERROR, ("SetConfig ok, %d", restart_required));
-    mgos_sys_config_save(&mgos_sys_config, false /* try once */, nullptr);
+    RequestConfigSave();
     if (restart_required) {
       LOG(LL_INFO, ("Configuration change requires server restart"));
       RestartService();
@@ -255,14 +455,10 @@ static void SetStateHandler(struct mg_rpc_request_info *ri, void *cb_arg,
   }
 
   Status st = Status::OK();
-  bool found = false;
-  for (auto &c : g_comps) {
-    if (c->id() != id || (int) c->type() != type) continue;
+  Component *c = FindComponent((Component::Type) type, id);
+  if (c != nullptr) {
     st = c->SetState(std::string(state_tok.ptr, state_tok.len));
-    found = true;
-    break;
-  }
-  if (!found) {
+  } else {
     st = mgos::Errorf(STATUS_INVALID_ARGUMENT, "component not found");
   }
   SendStatusResp(ri, st);
@@ -271,6 +467,271 @@ static void SetStateHandler(struct mg_rpc_request_info *ri, void *cb_arg,
   (void) fi;
 }
 
+#define MAX_MULTI_ITEMS 16
+
+struct MultiItem {
+  int id;
+  int type;
+  struct json_token tok;
+  Status st;
+  bool applied;
+};
+
+// Parses and validates an array of {id, type, <key>} entries.
+// Nothing is applied unless every entry refers to an existing target.
+static Status ParseMultiItems(const struct json_token &items_tok,
+                              const char *item_fmt, bool allow_sys,
+                              std::vector<MultiItem> *items) {
+  if (items_tok.type != JSON_TYPE_ARRAY_END) {
+    return mgos::Errorf(STATUS_INVALID_ARGUMENT, "%s is required", "items");
+  }
+  struct json_token item_tok;
+  for (int i = 0; json_scanf_array_elem(items_tok.ptr, items_tok.len, "", i,
+                                        &item_tok) > 0;
+       i++) {
+    if (i >= MAX_MULTI_ITEMS) {
+      return mgos::Errorf(STATUS_INVALID_ARGUMENT, "too many %s", "items");
+    }
+    MultiItem item = {-1, -1, JSON_INVALID_TOKEN, Status::OK(), false};
+    json_scanf(item_tok.ptr, item_tok.len, item_fmt, &item.id, &item.type,
+               &item.tok);
+    if (item.tok.len == 0) {
+      return mgos::Errorf(STATUS_INVALID_ARGUMENT, "item %d: invalid entry",
+                          i);
+    }
+    bool is_sys = (allow_sys && IsSysItem(item.id, item.type));
+    if (!is_sys &&
+        FindComponent((Component::Type) item.type, item.id) == nullptr) {
+      return mgos::Errorf(STATUS_INVALID_ARGUMENT,
+                          "item %d: component not found", i);
+    }
+    items->push_back(item);
+  }
+  if (items->empty()) {
+    return mgos::Errorf(STATUS_INVALID_ARGUMENT, "%s is required", "items");
+  }
+  return Status::OK();
+}
+
+// After a failure, marks all the entries not yet applied as aborted.
+static void AbortMultiItems(std::vector<MultiItem> *items) {
+  for (auto &item : *items) {
+    if (!item.st.ok() || item.applied) continue;
+    item.st = mgos::Errorf(STATUS_ABORTED, "not applied");
+  }
+}
+
+static void SendMultiResp(struct mg_rpc_request_info *ri,
+                          const std::vector<MultiItem> &items) {
+  std::string res = "{results: [";
+  bool first = true;
+  for (const auto &item : items) {
+    if (!first) res.append(", ");
+    if (item.st.ok()) {
+      mgos::JSONAppendStringf(&res, "{id: %d, type: %d, ok: %B}", item.id,
+                              item.type, true);
+    } else {
+      mgos::JSONAppendStringf(&res, "{id: %d, type: %d, ok: %B, error: %Q}",
+                              item.id, item.type, false,
+                              item.st.error_message().c_str());
+    }
+    first = false;
+  }
+  res.append("]}");
+  mg_rpc_send_responsef(ri, "%s", res.c_str());
+}
+
+static void SetConfigMultiHandler(struct mg_rpc_request_info *ri,
+                                  void *cb_arg, struct mg_rpc_frame_info *fi,
+                                  struct mg_str args) {
+  struct json_token items_tok = JSON_INVALID_TOKEN;
+
+  json_scanf(args.p, args.len, ri->args_fmt, &items_tok);
+
+  std::vector<MultiItem> items;
+  Status st = ParseMultiItems(items_tok, "{id: %d, type: %d, config: %T}",
+                              true /* allow_sys */, &items);
+  if (!st.ok()) {
+    SendStatusResp(ri, st);
+    return;
+  }
+
+  // Everything is validated before anything is applied,
+  // so a bad entry leaves the config untouched.
+  for (auto &item : items) {
+    if (IsSysItem(item.id, item.type)) {
+      SysSettings ss;
+      item.st = ParseSysConfig(item.tok, &ss);
+    } else {
+      Component *c = FindComponent((Component::Type) item.type, item.id);
+      item.st = c->ValidateConfig(std::string(item.tok.ptr, item.tok.len));
+    }
+    if (!item.st.ok()) {
+      AbortMultiItems(&items);
+      SendMultiResp(ri, items);
+      return;
+    }
+  }
+
+  // System settings have side effects beyond config, apply them last.
+  std::vector<MultiItem *> order;
+  for (auto &item : items) {
+    if (!IsSysItem(item.id, item.type)) order.push_back(&item);
+  }
+  for (auto &item : items) {
+    if (IsSysItem(item.id, item.type)) order.push_back(&item);
+  }
+  int num_applied = 0;
+  bool restart_required = false;
+  for (MultiItem *item : order) {
+    item->st =
+        ApplyConfig(item->id, item->type, item->tok, &restart_required);
+    if (!item->st.ok()) {
+      LOG(LL_ERROR, ("SetConfigMulti: item %d/%d failed after validation",
+                     item->id, item->type));
+      AbortMultiItems(&items);
+      break;
+    }
+    item->applied = true;
+    num_applied++;
+  }
+  LOG(LL_INFO, ("SetConfigMulti: %d of %d applied, %d", num_applied,
+                (int) items.size(), restart_required));
+  if (num_applied > 0) RequestConfigSave();
+  if (restart_required) {
+    LOG(LL_INFO, ("Configuration change requires server restart"));
+    RestartService();
+  }
+  SendMultiResp(ri, items);
+
+  (void) cb_arg;
+  (void) fi;
+}
+
+static void SetStateMultiHandler(struct mg_rpc_request_info *ri, void *cb_arg,
+                                 struct mg_rpc_frame_info *fi,
+                                 struct mg_str args) {
+  struct json_token items_tok = JSON_INVALID_TOKEN;
+
+  json_scanf(args.p, args.len, ri->args_fmt, &items_tok);
+
+  std::vector<MultiItem> items;
+  Status st = ParseMultiItems(items_tok, "{id: %d, type: %d, state: %T}",
+                              false /* allow_sys */, &items);
+  if (!st.ok()) {
+    SendStatusResp(ri, st);
+    return;
+  }
+
+  // State changes cannot be undone, validate everything first.
+  for (auto &item : items) {
+    Component *c = FindComponent((Component::Type) item.type, item.id);
+    item.st = c->ValidateState(std::string(item.tok.ptr, item.tok.len));
+    if (!item.st.ok()) {
+      AbortMultiItems(&items);
+      SendMultiResp(ri, items);
+      return;
+    }
+  }
+  for (auto &item : items) {
+    Component *c = FindComponent((Component::Type) item.type, item.id);
+    item.st = c->SetState(std::string(item.tok.ptr, item.tok.len));
+  }
+  SendMultiResp(ri, items);
+
+  (void) cb_arg;
+  (void) fi;
+}
+
+struct HistoryPrintArgs {
+  const PowerHistory *h;
+  PowerHistory::Tier tier;
+};
+
+// Prints samples straight from the ring buffer, without an intermediate copy.
+static int PrintPowerHistory(struct json_out *out, va_list *ap) {
+  const HistoryPrintArgs *args = va_arg(*ap, const HistoryPrintArgs *);
+  int len = 0;
+  int size = (args->h != nullptr ? args->h->GetSize(args->tier) : 0);
+  for (int i = 0; i < size; i++) {
+    len += json_printf(out, (i == 0 ? "%u" : ",%u"),
+                       (unsigned) args->h->GetSample(args->tier, i));
+  }
+  return len;
+}
+
+static void GetPowerHistoryHandler(struct mg_rpc_request_info *ri,
+                                   void *cb_arg, struct mg_rpc_frame_info *fi,
+                                   struct mg_str args) {
+  int id = -1, tier = (int) PowerHistory::Tier::kSecond;
+
+  json_scanf(args.p, args.len, ri->args_fmt, &id, &tier);
+
+  PowerMeter *pm = FindPM(id);
+  if (pm == nullptr) {
+    mg_rpc_send_errorf(ri, 400, "invalid %s", "id");
+    return;
+  }
+  if (tier < (int) PowerHistory::Tier::kSecond ||
+      tier > (int) PowerHistory::Tier::kHour) {
+    mg_rpc_send_errorf(ri, 400, "invalid %s", "tier");
+    return;
+  }
+  HistoryPrintArgs pa = {pm->GetHistory(), (PowerHistory::Tier) tier};
+  mg_rpc_send_responsef(
+      ri,
+      "{id: %d, tier: %d, interval: %d, scale: %.1f, "
+      "uptime: %.3f, last_ts: %.3f, samples: [%M]}",
+      id, tier, PowerHistory::GetInterval(pa.tier), PowerHistory::kScale,
+      mgos_uptime(),
+      (pa.h != nullptr ? pa.h->GetLastSampleTime(pa.tier) : 0.0),
+      PrintPowerHistory, &pa);
+
+  (void) cb_arg;
+  (void) fi;
+}
+
+static void GetEnergyHandler(struct mg_rpc_request_info *ri, void *cb_arg,
+                             struct mg_rpc_frame_info *fi, struct mg_str args) {
+  int id = -1;
+
+  json_scanf(args.p, args.len, ri->args_fmt, &id);
+
+  PowerMeter *pm = FindPM(id);
+  if (pm == nullptr) {
+    mg_rpc_send_errorf(ri, 400, "invalid %s", "id");
+    return;
+  }
+  float energy_wh = 0;
+  auto ev = pm->GetEnergyWH();
+  if (ev.ok()) energy_wh = ev.ValueOrDie();
+  // Doubles represent integers exactly up to 2^53, plenty for mWh.
+  mg_rpc_send_responsef(ri, "{id: %d, energy_mwh: %.0f, energy_wh: %.3f}", id,
+                        (double) pm->GetEnergyMWh(), energy_wh);
+
+  (void) cb_arg;
+  (void) fi;
+}
+
+static void ResetEnergyHandler(struct mg_rpc_request_info *ri, void *cb_arg,
+                               struct mg_rpc_frame_info *fi,
+                               struct mg_str args) {
+  int id = -1;
+
+  json_scanf(args.p, args.len, ri->args_fmt, &id);
+
+  PowerMeter *pm = FindPM(id);
+  if (pm == nullptr) {
+    mg_rpc_send_errorf(ri, 400, "invalid %s", "id");
+    return;
+  }
+  pm->ResetEnergy();
+  mg_rpc_send_responsef(ri, nullptr);
+
+  (void) cb_arg;
+  (void) fi;
+}
+
 static void InjectInputEventHandler(struct mg_rpc_request_info *ri,
                                     void *cb_arg, struct mg_rpc_frame_info *fi,
                                     struct mg_str args) {
@@ -286,7 +747,7 @@ static void InjectInputEventHandler(struct mg_rpc_request_info *ri,
   // For now we only allow "higher-level" events to be injected,
   // since injecting Change won't match with the value returne by GetState.
   if (ev != (int) Input::Event::kSingle && ev != (int) Input::Event::kDouble &&
-      ev != (int) Input::Event::kLong) {
+      ev != (int) Input::Event::kLong && ev != (int) Input::Event::kTriple) {
     mg_rpc_send_errorf(ri, 400, "invalid %s", "event");
     return;
   }
@@ -349,7 +810,7 @@ static Status SetAuthFileName(const std::string &passwd_fname,
   mgos_sys_config_set_rpc_auth_domain(auth_domain.c_str());
   mgos_sys_config_set_rpc_acl_file(acl_fname.c_str());
   char *err = nullptr;
-  if (!mgos_sys_config_save(&mgos_sys_config, false /* try once */, &err)) {
+  if (!SaveConfig(&err)) {
     return mgos::Errorf(STATUS_UNAVAILABLE, "Failed to save config: %s", err);
   }
   struct mg_http_endpoint *ep =
@@ -401,6 +862,7 @@ static void SetAuthHandler(struct mg_rpc_request_info *ri, void *cb_arg,
   size_t l = std::string(ha1).length();
   if (l == 0) {
     auto st = SetAuthFileName("", "", "");
+    s_sys_info_dirty = true;  // auth_en
     if (st.ok()) remove(AUTH_FILE_NAME);
     SendStatusResp(ri, st);
     return;
@@ -418,6 +880,7 @@ static void SetAuthHandler(struct mg_rpc_request_info *ri, void *cb_arg,
   fclose(fp);
 
   auto st = SetAuthFileName(AUTH_FILE_NAME, realm, ACL_FILE_NAME);
+  s_sys_info_dirty = true;  // auth_en
   SendStatusResp(ri, st);
 
   (void) cb_arg;
@@ -435,12 +898,25 @@ bool shelly_rpc_service_init(HAPAccessoryServerRef *server,
   if (server != nullptr) {
     mg_rpc_add_handler(mgos_rpc_get_global(), "Shelly.GetInfoExt", "",
                        GetInfoExtHandler, nullptr);
+    mg_rpc_add_handler(mgos_rpc_get_global(), "Shelly.Subscribe", "",
+                       SubscribeHandler, nullptr);
+    mg_rpc_add_observer(mgos_rpc_get_global(), RPCObserverCB, nullptr);
     mg_rpc_add_handler(mgos_rpc_get_global(), "Shelly.SetConfig",
                        "{id: %d, type: %d, config: %T}", SetConfigHandler,
                        nullptr);
     mg_rpc_add_handler(mgos_rpc_get_global(), "Shelly.SetState",
                        "{id: %d, type: %d, state: %T}", SetStateHandler,
                        nullptr);
+    mg_rpc_add_handler(mgos_rpc_get_global(), "Shelly.SetConfigMulti",
+                       "{items: %T}", SetConfigMultiHandler, nullptr);
+    mg_rpc_add_handler(mgos_rpc_get_global(), "Shelly.SetStateMulti",
+                       "{items: %T}", SetStateMultiHandler, nullptr);
+    mg_rpc_add_handler(mgos_rpc_get_global(), "Shelly.GetPowerHistory",
+                       "{id: %d, tier: %d}", GetPowerHistoryHandler, nullptr);
+    mg_rpc_add_handler(mgos_rpc_get_global(), "Shelly.GetEnergy", "{id: %d}",
+                       GetEnergyHandler, nullptr);
+    mg_rpc_add_handler(mgos_rpc_get_global(), "Shelly.ResetEnergy",
+                       "{id: %d}", ResetEnergyHandler, nullptr);
     mg_rpc_add_handler(mgos_rpc_get_global(), "Shelly.InjectInputEvent",
                        "{id: %d, event: %d}", InjectInputEventHandler, nullptr);
     mg_rpc_add_handler(mgos_rpc_get_global(), "Shelly.Abort", "", AbortHandler,
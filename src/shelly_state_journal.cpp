@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) Shelly-HomeKit Contributors
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shelly_state_journal.hpp"
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include <vector>
+
+#include "mgos.hpp"
+
+#define STATE_JOURNAL_TMP_FILE_NAME STATE_JOURNAL_FILE_NAME ".tmp"
+#define STATE_JOURNAL_MAX_RECORDS 256
+#define STATE_JOURNAL_FLUSH_DELAY_MS 1000
+// Record type used for power meters, never used by components.
+#define STATE_JOURNAL_TYPE_PM 0xff
+
+namespace shelly {
+
+struct StateJournalRecord {
+  uint8_t type;
+  uint8_t id;
+  uint8_t key;
+  int32_t value;
+  uint16_t csum;  // CRC-16/CCITT of the preceding fields.
+} __attribute__((packed));
+
+struct StateJournalEntry {
+  StateJournalRecord rec;
+  bool dirty;
+};
+
+static std::vector<StateJournalEntry> s_entries;
+static int s_num_file_records = 0;
+static mgos_timer_id s_flush_timer_id = MGOS_INVALID_TIMER_ID;
+
+static uint16_t RecordCSum(const StateJournalRecord &rec) {
+  uint16_t crc = 0xffff;
+  const uint8_t *p = (const uint8_t *) &rec;
+  for (size_t i = 0; i < offsetof(StateJournalRecord, csum); i++) {
+    crc ^= (p[i] << 8);
+    for (int j = 0; j < 8; j++) {
+      crc = (crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1);
+    }
+  }
+  return crc;
+}
+
+static StateJournalEntry *FindEntry(uint8_t type, uint8_t id, uint8_t key) {
+  for (auto &e : s_entries) {
+    if (e.rec.type == type && e.rec.id == id && e.rec.key == key) return &e;
+  }
+  return nullptr;
+}
+
+static bool WriteRecord(FILE *fp, StateJournalRecord *rec) {
+  rec->csum = RecordCSum(*rec);
+  return (fwrite(rec, sizeof(*rec), 1, fp) == 1);
+}
+
+// Rewrite the file with current values only.
+static bool Compact() {
+  FILE *fp = fopen(STATE_JOURNAL_TMP_FILE_NAME, "w");
+  if (fp == nullptr) return false;
+  bool ok = true;
+  for (auto &e : s_entries) {
+    ok = ok && WriteRecord(fp, &e.rec);
+  }
+  ok = (fclose(fp) == 0) && ok;
+  if (ok) {
+    ok = (rename(STATE_JOURNAL_TMP_FILE_NAME, STATE_JOURNAL_FILE_NAME) == 0);
+  }
+  if (!ok) {
+    LOG(LL_ERROR, ("Failed to compact state journal"));
+    remove(STATE_JOURNAL_TMP_FILE_NAME);
+    return false;
+  }
+  LOG(LL_DEBUG, ("State journal compacted: %d -> %d", s_num_file_records,
+                 (int) s_entries.size()));
+  s_num_file_records = s_entries.size();
+  for (auto &e : s_entries) {
+    e.dirty = false;
+  }
+  return true;
+}
+
+static void FlushTimerCB(void *arg) {
+  s_flush_timer_id = MGOS_INVALID_TIMER_ID;
+  StateJournalFlush();
+  (void) arg;
+}
+
+Status StateJournalInit() {
+  s_entries.clear();
+  s_num_file_records = 0;
+  FILE *fp = fopen(STATE_JOURNAL_FILE_NAME, "r");
+  if (fp == nullptr) return Status::OK();
+  bool need_compact = false;
+  StateJournalRecord rec;
+  while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+    if (rec.csum != RecordCSum(rec)) {
+      // Most likely an interrupted write, nothing valid can follow.
+      LOG(LL_WARN, ("State journal corrupted at %d", s_num_file_records));
+      need_compact = true;
+      break;
+    }
+    s_num_file_records++;
+    StateJournalEntry *e = FindEntry(rec.type, rec.id, rec.key);
+    if (e != nullptr) {
+      e->rec = rec;
+    } else {
+      s_entries.push_back({rec, false /* dirty */});
+    }
+  }
+  // Anything left over, e.g. a partial record from an interrupted write,
+  // would misalign subsequent appends, so it must be dropped.
+  long valid_size = s_num_file_records * sizeof(rec);
+  if (fseek(fp, 0, SEEK_END) != 0 || ftell(fp) != valid_size) {
+    need_compact = true;
+  }
+  fclose(fp);
+  LOG(LL_INFO, ("State journal: %d records, %d values", s_num_file_records,
+                (int) s_entries.size()));
+  if (need_compact || s_num_file_records > STATE_JOURNAL_MAX_RECORDS) {
+    if (!Compact()) {
+      return mgos::Errorf(STATUS_DATA_LOSS, "failed to compact %s",
+                          STATE_JOURNAL_FILE_NAME);
+    }
+  }
+  return Status::OK();
+}
+
+static bool Get(uint8_t type, int id, StateKey key, int32_t *value) {
+  const StateJournalEntry *e = FindEntry(type, (uint8_t) id, (uint8_t) key);
+  if (e == nullptr) return false;
+  *value = e->rec.value;
+  return true;
+}
+
+static void Put(uint8_t type, int id, StateKey key, int32_t value) {
+  StateJournalEntry *e = FindEntry(type, (uint8_t) id, (uint8_t) key);
+  if (e == nullptr) {
+    StateJournalRecord rec = {
+        .type = type,
+        .id = (uint8_t) id,
+        .key = (uint8_t) key,
+        .value = value,
+        .csum = 0,
+    };
+    s_entries.push_back({rec, true /* dirty */});
+  } else if (e->rec.value != value) {
+    e->rec.value = value;
+    e->dirty = true;
+  } else {
+    return;
+  }
+  if (s_flush_timer_id == MGOS_INVALID_TIMER_ID) {
+    s_flush_timer_id = mgos_set_timer(STATE_JOURNAL_FLUSH_DELAY_MS, 0,
+                                      FlushTimerCB, nullptr /* arg */);
+  }
+}
+
+bool StateJournalGet(Component::Type type, int id, StateKey key,
+                     int32_t *value) {
+  return Get((uint8_t) type, id, key, value);
+}
+
+void StateJournalPut(Component::Type type, int id, StateKey key,
+                     int32_t value) {
+  Put((uint8_t) type, id, key, value);
+}
+
+bool StateJournalGetPM(int id, StateKey key, int32_t *value) {
+  return Get(STATE_JOURNAL_TYPE_PM, id, key, value);
+}
+
+void StateJournalPutPM(int id, StateKey key, int32_t value) {
+  Put(STATE_JOURNAL_TYPE_PM, id, key, value);
+}
+
+void StateJournalFlush() {
+  mgos_clear_timer(s_flush_timer_id);
+  s_flush_timer_id = MGOS_INVALID_TIMER_ID;
+  int num_dirty = 0;
+  for (const auto &e : s_entries) {
+    if (e.dirty) num_dirty++;
+  }
+  if (num_dirty == 0) return;
+  if (s_num_file_records + num_dirty > STATE_JOURNAL_MAX_RECORDS) {
+    Compact();
+    return;
+  }
+  FILE *fp = fopen(STATE_JOURNAL_FILE_NAME, "a");
+  if (fp == nullptr) {
+    LOG(LL_ERROR, ("Failed to open %s", STATE_JOURNAL_FILE_NAME));
+    return;
+  }
+  for (auto &e : s_entries) {
+    if (!e.dirty) continue;
+    if (!WriteRecord(fp, &e.rec)) break;
+    e.dirty = false;
+    s_num_file_records++;
+  }
+  fclose(fp);
+}
+
+}  // namespace shelly
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) Shelly-HomeKit Contributors
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "shelly_common.hpp"
+#include "shelly_component.hpp"
+
+#define STATE_JOURNAL_FILE_NAME "state.bin"
+
+namespace shelly {
+
+// Journal of frequently changing runtime state (output state, brightness,
+// position, etc.), kept separately from the config so that state changes
+// don't require rewriting the whole config file.
+// Values are appended to the file as fixed-size records, last record for
+// a given key wins. When the file grows too big, it is compacted by writing
+// out only the current values.
+
+enum class StateKey : uint8_t {
+  kOn = 0,
+  kBrightness = 1,
+  kHue = 2,
+  kSaturation = 3,
+  kPosition = 4,
+  // Power meter energy counter, mWh, split into two halves.
+  kEnergyLo = 5,
+  kEnergyHi = 6,
+};
+
+Status StateJournalInit();
+
+bool StateJournalGet(Component::Type type, int id, StateKey key,
+                     int32_t *value);
+
+// Record new value. Writes are delayed slightly to coalesce rapid changes.
+void StateJournalPut(Component::Type type, int id, StateKey key,
+                     int32_t value);
+
+// Power meters are not components, their values are kept separately.
+bool StateJournalGetPM(int id, StateKey key, int32_t *value);
+void StateJournalPutPM(int id, StateKey key, int32_t value);
+
+// Write out pending changes now.
+void StateJournalFlush();
+
+}  // namespace shelly
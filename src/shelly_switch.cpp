@@ -17,11 +17,14 @@
 
 #include "shelly_switch.hpp"
 
+#include <algorithm>
+
 #include "mgos.hpp"
 #include "mgos_hap_accessory.hpp"
 #include "mgos_hap_chars.hpp"
 
 #include "shelly_main.hpp"
+#include "shelly_state_journal.hpp"
 
 namespace shelly {
 
@@ -40,7 +43,44 @@ ShellySwitch::~ShellySwitch() {
   if (in_ != nullptr) {
     in_->RemoveHandler(handler_id_);
   }
-  SaveState();
+  if (out_pm_ != nullptr) {
+    out_pm_->RemoveHandler(pm_handler_id_);
+    out_pm_->SetFastSampling(false);
+  }
+}
+
+static std::string PowerRuleJSON(const struct mgos_config_sw_pr *pr) {
+  return mgos::JSONPrintStringf(
+      "{action: %d, above: %B, threshold: %.3f, hysteresis: %.3f, "
+      "hold_time: %d}",
+      pr->action, pr->above, pr->threshold, pr->hysteresis, pr->hold_time);
+}
+
+static Status ParsePowerRule(const struct json_token &tok,
+                             struct mgos_config_sw_pr *pr) {
+  if (tok.ptr == nullptr) return Status::OK();
+  struct mgos_config_sw_pr npr = *pr;
+  json_scanf(tok.ptr, tok.len,
+             "{action: %d, above: %B, threshold: %lf, hysteresis: %lf, "
+             "hold_time: %d}",
+             &npr.action, &npr.above, &npr.threshold, &npr.hysteresis,
+             &npr.hold_time);
+  if (npr.action < 0 ||
+      npr.action >= (int) ShellySwitch::PowerRuleAction::kMax) {
+    return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "action");
+  }
+  if (npr.threshold < 0) {
+    return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "threshold");
+  }
+  if (npr.hysteresis < 0) {
+    return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "hysteresis");
+  }
+  if (npr.hold_time < 0) {
+    return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "hold_time");
+  }
+  npr.above = (npr.above != 0);
+  *pr = npr;
+  return Status::OK();
 }
 
 Component::Type ShellySwitch::type() const {
@@ -54,7 +94,6 @@ std::string ShellySwitch::name() const {
 StatusOr<std::string> ShellySwitch::GetInfo() const {
   int in_st = -1;
   if (in_ != nullptr) in_st = in_->GetState();
-  const_cast<ShellySwitch *>(this)->SaveState();
   return mgos::SPrintf("st:%d in_st:%d inm:%d ininv:%d", out_->GetState(),
                        in_st, cfg_->in_mode, cfg_->in_inverted);
 }
@@ -77,57 +116,118 @@ StatusOr<std::string> ShellySwitch::GetInfoJSON() const {
     if (energy.ok()) {
       mgos::JSONAppendStringf(&res, ", aenergy: %.3f", energy.ValueOrDie());
     }
+    auto voltage = out_pm_->GetVoltageV();
+    if (voltage.ok()) {
+      mgos::JSONAppendStringf(&res, ", voltage: %.1f", voltage.ValueOrDie());
+    }
+    auto current = out_pm_->GetCurrentA();
+    if (current.ok()) {
+      mgos::JSONAppendStringf(&res, ", current: %.3f", current.ValueOrDie());
+    }
+    auto rpower = out_pm_->GetReactivePowerVAR();
+    if (rpower.ok()) {
+      mgos::JSONAppendStringf(&res, ", rpower: %.3f", rpower.ValueOrDie());
+    }
+    auto pf = out_pm_->GetPowerFactor();
+    if (pf.ok()) {
+      mgos::JSONAppendStringf(&res, ", pf: %.2f", pf.ValueOrDie());
+    }
+    mgos::JSONAppendStringf(&res,
+                            ", max_power: %d, max_power_time_ms: %d, "
+                            "overpower: %B",
+                            cfg_->max_power, cfg_->max_power_time_ms,
+                            overpower_);
+    if (overpower_) {
+      mgos::JSONAppendStringf(&res, ", overpower_peak: %.1f", overpower_peak_);
+    }
+    const std::string &pr1 = PowerRuleJSON(&cfg_->pr1);
+    const std::string &pr2 = PowerRuleJSON(&cfg_->pr2);
+    mgos::JSONAppendStringf(&res, ", pr1: %s, pr2: %s", pr1.c_str(),
+                            pr2.c_str());
   }
   res.append("}");
   return res;
 }
 
-Status ShellySwitch::SetConfig(const std::string &config_json,
-                               bool *restart_required) {
-  struct mgos_config_sw cfg = *cfg_;
-  int8_t in_inverted = -1;
-  cfg.name = nullptr;
-  cfg.in_mode = -2;
+Status ShellySwitch::ParseConfig(const std::string &config_json,
+                                 struct mgos_config_sw *cfg,
+                                 int8_t *in_inverted) const {
+  struct json_token pr1_tok = JSON_INVALID_TOKEN;
+  struct json_token pr2_tok = JSON_INVALID_TOKEN;
+  *cfg = *cfg_;
+  cfg->name = nullptr;
+  cfg->in_mode = -2;
   json_scanf(
       config_json.c_str(), config_json.size(),
       "{name: %Q, svc_type: %d, valve_type: %d, in_mode: %d, in_inverted: %B, "
       "initial_state: %d, "
-      "auto_off: %B, auto_off_delay: %lf, state_led_en: %d, out_inverted: %B}",
-      &cfg.name, &cfg.svc_type, &cfg.valve_type, &cfg.in_mode, &in_inverted,
-      &cfg.initial_state, &cfg.auto_off, &cfg.auto_off_delay, &cfg.state_led_en,
-      &cfg.out_inverted);
-  mgos::ScopedCPtr name_owner((void *) cfg.name);
+      "auto_off: %B, auto_off_delay: %lf, state_led_en: %d, out_inverted: %B, "
+      "max_power: %d, max_power_time_ms: %d, pr1: %T, pr2: %T}",
+      &cfg->name, &cfg->svc_type, &cfg->valve_type, &cfg->in_mode,
+      in_inverted, &cfg->initial_state, &cfg->auto_off, &cfg->auto_off_delay,
+      &cfg->state_led_en, &cfg->out_inverted, &cfg->max_power,
+      &cfg->max_power_time_ms, &pr1_tok, &pr2_tok);
   // Validation.
-  if (cfg.name != nullptr && strlen(cfg.name) > 64) {
+  if (cfg->name != nullptr && strlen(cfg->name) > 64) {
     return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s",
                         "name (too long, max 64)");
   }
-  if (cfg.svc_type < -1 || cfg.svc_type > 3) {
+  if (cfg->svc_type < -1 || cfg->svc_type > 3) {
     return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "svc_type");
   }
-  if ((cfg.svc_type != 3 && cfg.valve_type != -1) ||
-      (cfg.svc_type == 3 && cfg.valve_type < 0) ||
-      (cfg.svc_type == 3 && cfg.valve_type > 1)) {
+  if ((cfg->svc_type != 3 && cfg->valve_type != -1) ||
+      (cfg->svc_type == 3 && cfg->valve_type < 0) ||
+      (cfg->svc_type == 3 && cfg->valve_type > 1)) {
     return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "valve_type");
   }
-  if (cfg.in_mode != -2 &&
-      (cfg.in_mode < 0 || cfg.in_mode >= (int) InMode::kMax)) {
+  if (cfg->in_mode != -2 &&
+      (cfg->in_mode < 0 || cfg->in_mode >= (int) InMode::kMax)) {
     return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "in_mode");
   }
-  if (cfg.initial_state < 0 || cfg.initial_state >= (int) InitialState::kMax ||
+  if (cfg->initial_state < 0 ||
+      cfg->initial_state >= (int) InitialState::kMax ||
       (cfg_->in_mode == -1 &&
-       cfg.initial_state == (int) InitialState::kInput)) {
+       cfg->initial_state == (int) InitialState::kInput)) {
     return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "initial_state");
   }
-  cfg.auto_off = (cfg.auto_off != 0);
-  if (cfg.initial_state < 0 || cfg.initial_state > (int) InitialState::kMax) {
+  cfg->auto_off = (cfg->auto_off != 0);
+  if (cfg->initial_state < 0 ||
+      cfg->initial_state > (int) InitialState::kMax) {
     return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "initial_state");
   }
-  if ((cfg_->state_led_en == -1 && cfg.state_led_en != -1) ||
-      (cfg_->state_led_en != -1 && cfg.state_led_en != 0 &&
-       cfg.state_led_en != 1)) {
+  if ((cfg_->state_led_en == -1 && cfg->state_led_en != -1) ||
+      (cfg_->state_led_en != -1 && cfg->state_led_en != 0 &&
+       cfg->state_led_en != 1)) {
     return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "state_led_en");
   }
+  if (cfg->max_power < -1) {
+    return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "max_power");
+  }
+  if (cfg->max_power_time_ms < 0) {
+    return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s",
+                        "max_power_time_ms");
+  }
+  Status st;
+  if (!(st = ParsePowerRule(pr1_tok, &cfg->pr1)).ok()) return st;
+  if (!(st = ParsePowerRule(pr2_tok, &cfg->pr2)).ok()) return st;
+  return Status::OK();
+}
+
+Status ShellySwitch::ValidateConfig(const std::string &config_json) const {
+  struct mgos_config_sw cfg;
+  int8_t in_inverted = -1;
+  Status st = ParseConfig(config_json, &cfg, &in_inverted);
+  mgos::ScopedCPtr name_owner((void *) cfg.name);
+  return st;
+}
+
+Status ShellySwitch::SetConfig(const std::string &config_json,
+                               bool *restart_required) {
+  struct mgos_config_sw cfg;
+  int8_t in_inverted = -1;
+  Status st = ParseConfig(config_json, &cfg, &in_inverted);
+  mgos::ScopedCPtr name_owner((void *) cfg.name);
+  if (!st.ok()) return st;
   // Now copy over.
   if (cfg_->name != nullptr && strcmp(cfg_->name, cfg.name) != 0) {
     mgos_conf_set_str(&cfg_->name, cfg.name);
@@ -163,15 +263,33 @@ Status ShellySwitch::SetConfig(const std::string &config_json,
     cfg_->out_inverted = cfg.out_inverted;
     *restart_required = true;
   }
+  cfg_->max_power = cfg.max_power;
+  cfg_->max_power_time_ms = cfg.max_power_time_ms;
+  UpdateFastSampling();
+  if (memcmp(&cfg_->pr1, &cfg.pr1, sizeof(cfg.pr1)) != 0 ||
+      memcmp(&cfg_->pr2, &cfg.pr2, sizeof(cfg.pr2)) != 0) {
+    cfg_->pr1 = cfg.pr1;
+    cfg_->pr2 = cfg.pr2;
+    ResetPowerRules();
+  }
+  InvalidateInfo();
   return Status::OK();
 }
 
-Status ShellySwitch::SetState(const std::string &state_json) {
+Status ShellySwitch::ValidateState(const std::string &state_json) const {
   int8_t state = -1;
   json_scanf(state_json.c_str(), state_json.size(), "{state: %B}", &state);
   if (state < 0) {
     return mgos::Errorf(STATUS_INVALID_ARGUMENT, "%s is required", "state");
   }
+  return Status::OK();
+}
+
+Status ShellySwitch::SetState(const std::string &state_json) {
+  Status st = ValidateState(state_json);
+  if (!st.ok()) return st;
+  int8_t state = -1;
+  json_scanf(state_json.c_str(), state_json.size(), "{state: %B}", &state);
   SetOutputState(state, "RPC");
   return Status::OK();
 }
@@ -180,6 +298,11 @@ bool ShellySwitch::IsIdle() {
   return !auto_off_timer_.IsValid();
 }
 
+int ShellySwitch::GetInfoMaxAgeMs() const {
+  // Power readings are not tracked, refresh them periodically.
+  return (out_pm_ != nullptr ? 1000 : -1);
+}
+
 Status ShellySwitch::Init() {
   if (!cfg_->enable) {
     LOG(LL_INFO, ("'%s' is disabled", cfg_->name));
@@ -190,7 +313,15 @@ Status ShellySwitch::Init() {
         std::bind(&ShellySwitch::InputEventHandler, this, _1, _2));
     in_->SetInvert(cfg_->in_inverted);
   }
+  if (out_pm_ != nullptr) {
+    pm_handler_id_ = out_pm_->AddHandler(
+        std::bind(&ShellySwitch::PowerMeterHandler, this, _1));
+  }
   out_->SetInvert(cfg_->out_inverted);
+  int32_t state;
+  if (StateJournalGet(Type::kSwitch, id(), StateKey::kOn, &state)) {
+    cfg_->state = state;
+  }
   bool should_restore = (cfg_->initial_state == (int) InitialState::kLast);
   if (IsSoftReboot()) should_restore = true;
   if (should_restore) {
@@ -214,6 +345,7 @@ Status ShellySwitch::Init() {
         break;
     }
   }
+  UpdateFastSampling();
   LOG(LL_INFO, ("Exporting '%s': type %d, state: %d", cfg_->name,
                 cfg_->svc_type, out_->GetState()));
   return Status::OK();
@@ -231,7 +363,8 @@ void ShellySwitch::SetOutputState(bool new_state, const char *source) {
   }
   if (cfg_->state != new_state) {
     cfg_->state = new_state;
-    dirty_ = true;
+    StateJournalPut(Type::kSwitch, id(), StateKey::kOn, new_state);
+    InvalidateInfo();
   }
 
   if (new_state && cfg_->auto_off) {
@@ -240,8 +373,22 @@ void ShellySwitch::SetOutputState(bool new_state, const char *source) {
     auto_off_timer_.Clear();
   }
 
+  if (new_state && overpower_) {
+    LOG(LL_INFO, ("SW %d: Overpower fault cleared", id()));
+    overpower_ = false;
+    overpower_since_ = 0;
+    InvalidateInfo();
+  }
+
+  UpdateFastSampling();
+
   if (new_state == cur_state) return;
 
+  // Load changes, evaluate rules from scratch.
+  ResetPowerRules();
+
+  InvalidateInfo();
+
   for (auto *c : state_notify_chars_) {
     c->RaiseEvent();
   }
@@ -260,13 +407,109 @@ void ShellySwitch::AutoOffTimerCB() {
   SetOutputState(false, "auto_off");
 }
 
-void ShellySwitch::SaveState() {
-  if (!dirty_) return;
-  mgos_sys_config_save(&mgos_sys_config, false /* try_once */, NULL /* msg */);
-  dirty_ = false;
+int ShellySwitch::GetMaxPower() const {
+  if (cfg_->max_power < 0) return 0;
+  if (cfg_->max_power > 0) return cfg_->max_power;
+  // Not set for this output, use the device-wide limit.
+  return std::max(mgos_sys_config_get_max_power(), 0);
+}
+
+void ShellySwitch::UpdateFastSampling() {
+  if (out_pm_ == nullptr) return;
+  out_pm_->SetFastSampling(GetOutputState() && GetMaxPower() > 0);
+}
+
+void ShellySwitch::PowerMeterHandler(float w) {
+  int64_t now = mgos_uptime_micros();
+  // Overpower protection comes first, rules are not evaluated once it trips.
+  int max_power = GetMaxPower();
+  if (max_power > 0 && w > max_power) {
+    if (overpower_since_ == 0) overpower_since_ = now;
+    // Power has to stay over the limit for a while, to allow for inrush.
+    if (overpower_ ||
+        now - overpower_since_ >= cfg_->max_power_time_ms * 1000LL) {
+      if (!overpower_) {
+        LOG(LL_ERROR, ("SW %d: Overpower (%.2f W > %d W), turning off", id(),
+                       w, max_power));
+        overpower_ = true;
+        overpower_peak_ = w;
+        InvalidateInfo();
+      } else if (w > overpower_peak_) {
+        overpower_peak_ = w;
+        InvalidateInfo();
+      }
+      if (GetOutputState()) SetOutputState(false, "OVP");
+      return;
+    }
+  } else {
+    overpower_since_ = 0;
+  }
+  EvalPowerRule(0, &cfg_->pr1, w, now);
+  EvalPowerRule(1, &cfg_->pr2, w, now);
+}
+
+void ShellySwitch::EvalPowerRule(int i, const struct mgos_config_sw_pr *pr,
+                                 float w, int64_t now) {
+  PowerRuleAction action = static_cast<PowerRuleAction>(pr->action);
+  if (action == PowerRuleAction::kNone) return;
+  PowerRuleState &ps = pr_state_[i];
+  if (ps.triggered) {
+    // Wait for the condition to clear, with hysteresis.
+    bool cleared = (pr->above ? w < pr->threshold - pr->hysteresis
+                              : w > pr->threshold + pr->hysteresis);
+    if (!cleared) return;
+    LOG(LL_INFO, ("SW %d: PR%d cleared (%.2f W)", id(), i + 1, w));
+    ps.triggered = false;
+    if (action == PowerRuleAction::kNotify) SetInUse(!pr->above);
+    return;
+  }
+  bool cond = (pr->above ? w > pr->threshold : w < pr->threshold);
+  if (!cond) {
+    ps.cond_since = 0;
+    return;
+  }
+  if (ps.cond_since == 0) ps.cond_since = now;
+  if (now - ps.cond_since < pr->hold_time * 1000000LL) return;
+  LOG(LL_INFO, ("SW %d: PR%d triggered (%.2f W %s %.2f W), action %d", id(),
+                i + 1, w, (pr->above ? ">" : "<"), pr->threshold,
+                pr->action));
+  switch (action) {
+    case PowerRuleAction::kOff:
+      SetOutputState(false, "power_rule");
+      break;
+    case PowerRuleAction::kOn:
+      SetOutputState(true, "power_rule");
+      break;
+    case PowerRuleAction::kNotify:
+      SetInUse(pr->above);
+      break;
+    case PowerRuleAction::kNone:
+    case PowerRuleAction::kMax:
+      break;
+  }
+  // Changing output resets the rules, make sure we don't fire again
+  // until the condition clears.
+  ps.triggered = true;
+}
+
+void ShellySwitch::SetInUse(bool in_use) {
+  if (in_use == in_use_) return;
+  in_use_ = in_use;
+  for (auto *c : in_use_notify_chars_) {
+    c->RaiseEvent();
+  }
+}
+
+void ShellySwitch::ResetPowerRules() {
+  for (PowerRuleState &ps : pr_state_) {
+    ps.triggered = false;
+    ps.cond_since = 0;
+  }
 }
 
 void ShellySwitch::InputEventHandler(Input::Event ev, bool state) {
+  // Input state is part of the status.
+  if (ev == Input::Event::kChange) InvalidateInfo();
   InMode in_mode = static_cast<InMode>(cfg_->in_mode);
   if (in_mode == InMode::kDetached) {
     // Nothing to do
@@ -311,6 +554,9 @@ void ShellySwitch::InputEventHandler(Input::Event ev, bool state) {
     case Input::Event::kSingle:
     case Input::Event::kDouble:
     case Input::Event::kReset:
+    case Input::Event::kTriple:
+    case Input::Event::kHoldRepeat:
+    case Input::Event::kLongRelease:
     case Input::Event::kMax:
       break;
   }
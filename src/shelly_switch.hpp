@@ -36,6 +36,14 @@ namespace shelly {
 // Common base for Switch, Outlet and Lock services.
 class ShellySwitch : public Component, public mgos::hap::Service {
  public:
+  enum class PowerRuleAction {
+    kNone = 0,
+    kOff = 1,
+    kOn = 2,
+    kNotify = 3,
+    kMax,
+  };
+
   ShellySwitch(int id, Input *in, Output *out, PowerMeter *out_pm,
                Output *led_out, struct mgos_config_sw *cfg);
   virtual ~ShellySwitch();
@@ -48,8 +56,11 @@ class ShellySwitch : public Component, public mgos::hap::Service {
   StatusOr<std::string> GetInfoJSON() const override;
   Status SetConfig(const std::string &config_json,
                    bool *restart_required) override;
+  Status ValidateConfig(const std::string &config_json) const override;
   Status SetState(const std::string &state_json) override;
+  Status ValidateState(const std::string &state_json) const override;
   bool IsIdle() override;
+  int GetInfoMaxAgeMs() const override;
 
   bool GetOutputState() const;
   void SetOutputState(bool new_state, const char *source);
@@ -59,7 +70,18 @@ class ShellySwitch : public Component, public mgos::hap::Service {
 
   void AutoOffTimerCB();
 
-  void SaveState();
+  void PowerMeterHandler(float w);
+  void EvalPowerRule(int i, const struct mgos_config_sw_pr *pr, float w,
+                     int64_t now);
+  void SetInUse(bool in_use);
+  void ResetPowerRules();
+  // Overpower limit in effect, W. 0 if protection is disabled.
+  int GetMaxPower() const;
+  // Overpower protection needs power readings often while output is on.
+  void UpdateFastSampling();
+  // Parses config_json over the current config. cfg->name must be freed.
+  Status ParseConfig(const std::string &config_json,
+                     struct mgos_config_sw *cfg, int8_t *in_inverted) const;
 
   Input *const in_;
   Output *const out_;
@@ -68,10 +90,22 @@ class ShellySwitch : public Component, public mgos::hap::Service {
   struct mgos_config_sw *cfg_;
 
   Input::HandlerID handler_id_ = Input::kInvalidHandlerID;
+  PowerMeter::HandlerID pm_handler_id_ = PowerMeter::kInvalidHandlerID;
   std::vector<mgos::hap::Characteristic *> state_notify_chars_;
+  std::vector<mgos::hap::Characteristic *> in_use_notify_chars_;
+
+  struct PowerRuleState {
+    bool triggered = false;
+    int64_t cond_since = 0;  // When the condition was first met, 0 if not.
+  };
+  PowerRuleState pr_state_[2];
+  bool in_use_ = true;
+  // Overpower fault, latched until output is turned back on.
+  bool overpower_ = false;
+  float overpower_peak_ = 0;
+  int64_t overpower_since_ = 0;  // When power first went over, 0 if not.
 
   mgos::Timer auto_off_timer_;
-  bool dirty_ = false;
 
   ShellySwitch(const ShellySwitch &other) = delete;
 };
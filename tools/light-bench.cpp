@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) Shelly-HomeKit Contributors
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Light bulb colour maths check and benchmark, runs on the host.
+//
+// Compares the fixed point HSV to RGBW conversion, interpolation and
+// brightness curves against straightforward float versions and measures
+// the cost of a transition frame (4 channels interpolated and corrected)
+// both ways. Exits with non-zero status if results differ by more than
+// the allowed error.
+//
+// Host CPUs have an FPU and the ESP8266 does not, so float numbers here
+// are a lower bound of what float costs on the device.
+//
+// Build and run from the repo root:
+//   g++ -O2 -Isrc tools/light-bench.cpp src/shelly_light_c*.cpp -o light-bench
+//   ./light-bench
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC 1
+#endif
+
+#include "shelly_light_color.hpp"
+
+using namespace shelly;
+
+namespace {
+
+// Allowed difference, in LightLevel units (1 / 32768).
+constexpr int kMaxHSVError = 4;
+constexpr int kMaxLerpError = 1;
+constexpr int kMaxCurveError = 4;
+
+constexpr int kNumFrames = 1000000;
+
+struct RGBWf {
+  float r, g, b, w;
+};
+
+// Float version of HSVToRGBW().
+RGBWf HSVToRGBWf(int hue, int saturation, int brightness,
+                 bool extract_white) {
+  RGBWf rgbw = {};
+  float h = hue / 360.0f;
+  float s = saturation / 100.0f;
+  float v = brightness / 100.0f;
+  if (saturation == 0) {
+    rgbw.r = rgbw.g = rgbw.b = v;
+  } else {
+    int i = static_cast<int>(h * 6);
+    float f = (h * 6.0f - i);
+    float p = v * (1.0f - s);
+    float q = v * (1.0f - f * s);
+    float t = v * (1.0f - (1.0f - f) * s);
+    switch (i % 6) {
+      case 0:
+        rgbw = {v, t, p, 0};
+        break;
+      case 1:
+        rgbw = {q, v, p, 0};
+        break;
+      case 2:
+        rgbw = {p, v, t, 0};
+        break;
+      case 3:
+        rgbw = {p, q, v, 0};
+        break;
+      case 4:
+        rgbw = {t, p, v, 0};
+        break;
+      case 5:
+        rgbw = {v, p, q, 0};
+        break;
+    }
+  }
+  if (extract_white) {
+    rgbw.w = std::min(rgbw.r, std::min(rgbw.g, rgbw.b));
+    rgbw.r -= rgbw.w;
+    rgbw.g -= rgbw.w;
+    rgbw.b -= rgbw.w;
+  }
+  return rgbw;
+}
+
+float Lerpf(float a, float b, float alpha) {
+  return alpha * b + (1 - alpha) * a;
+}
+
+// Exact curves, what the tables approximate.
+float Curvef(LightCurve curve, float x) {
+  switch (curve) {
+    case LightCurve::kGamma:
+      return std::pow(x, 2.2f);
+    case LightCurve::kCIE1931: {
+      if (x <= 0.08f) return x * 100 / 903.3f;
+      float y = (x * 100 + 16) / 116;
+      return y * y * y;
+    }
+    default:
+      return x;
+  }
+}
+
+// Duty in and out, like the table lookup before levels became fixed point.
+float ApplyLightCurvef(LightCurve curve, float duty) {
+  if (duty <= 0) return 0;
+  if (duty >= 1) return 1;
+  LightLevel l = static_cast<LightLevel>(duty * kLightLevelMax + 0.5f);
+  return ApplyLightCurve(curve, l) * (1.0f / kLightLevelMax);
+}
+
+int Diff(float f, LightLevel l) {
+  return std::abs(static_cast<int>(std::lround(f * kLightLevelMax)) - l);
+}
+
+bool Report(const char *what, int max_err, int limit) {
+  bool ok = (max_err <= limit);
+  printf("%-8s max error %3d (limit %3d) %s\n", what, max_err, limit,
+         (ok ? "ok" : "FAIL"));
+  return ok;
+}
+
+bool CheckHSV() {
+  int max_err = 0;
+  for (int extract_white = 0; extract_white < 2; extract_white++) {
+    for (int h = 0; h < 360; h++) {
+      for (int s = 0; s <= 100; s++) {
+        for (int v = 0; v <= 100; v++) {
+          RGBW x = HSVToRGBW(h, s, v, extract_white);
+          RGBWf xf = HSVToRGBWf(h, s, v, extract_white);
+          max_err = std::max(max_err, Diff(xf.r, x.r));
+          max_err = std::max(max_err, Diff(xf.g, x.g));
+          max_err = std::max(max_err, Diff(xf.b, x.b));
+          max_err = std::max(max_err, Diff(xf.w, x.w));
+        }
+      }
+    }
+  }
+  return Report("hsv", max_err, kMaxHSVError);
+}
+
+bool CheckLerp() {
+  int max_err = 0;
+  for (uint32_t a = 0; a <= kLightLevelMax; a += 257) {
+    for (uint32_t b = 0; b <= kLightLevelMax; b += 263) {
+      for (uint32_t alpha = 0; alpha <= kLightLevelMax; alpha += 1021) {
+        LightLevel l = LightLevelLerp(a, b, alpha);
+        const float k = 1.0f / kLightLevelMax;
+        float f = Lerpf(a * k, b * k, alpha * k);
+        max_err = std::max(max_err, Diff(f, l));
+      }
+    }
+  }
+  return Report("lerp", max_err, kMaxLerpError);
+}
+
+bool CheckCurve(LightCurve curve, const char *name) {
+  int max_err = 0;
+  for (uint32_t l = 0; l <= kLightLevelMax; l++) {
+    float f = Curvef(curve, l * (1.0f / kLightLevelMax));
+    max_err = std::max(max_err, Diff(f, ApplyLightCurve(curve, l)));
+  }
+  return Report(name, max_err, kMaxCurveError);
+}
+
+volatile float s_sink_f;
+volatile uint32_t s_sink_l;
+
+struct Timing {
+  double ns;
+  double cycles;
+};
+
+template <class F>
+Timing Measure(F frame) {
+#ifdef HAVE_RDTSC
+  uint64_t c0 = __rdtsc();
+#endif
+  auto t0 = std::chrono::steady_clock::now();
+  for (int i = 0; i < kNumFrames; i++) frame(i);
+  auto t1 = std::chrono::steady_clock::now();
+  Timing res;
+  res.ns = std::chrono::duration<double, std::nano>(t1 - t0).count() /
+           kNumFrames;
+#ifdef HAVE_RDTSC
+  res.cycles = static_cast<double>(__rdtsc() - c0) / kNumFrames;
+#else
+  res.cycles = -1;
+#endif
+  return res;
+}
+
+void PrintTiming(const char *what, const Timing &t) {
+  if (t.cycles >= 0) {
+    printf("%-14s %7.1f ns/frame %7.1f cycles/frame\n", what, t.ns,
+           t.cycles);
+  } else {
+    printf("%-14s %7.1f ns/frame\n", what, t.ns);
+  }
+}
+
+void Bench() {
+  const LightCurve curve = LightCurve::kCIE1931;
+  const RGBW from = HSVToRGBW(30, 80, 10, true);
+  const RGBW to = HSVToRGBW(210, 40, 90, true);
+  const RGBWf fromf = HSVToRGBWf(30, 80, 10, true);
+  const RGBWf tof = HSVToRGBWf(210, 40, 90, true);
+
+  // One transition tick: interpolate and correct every channel.
+  Timing tf = Measure([&](int i) {
+    float alpha = static_cast<float>(i) / kNumFrames;
+    float sum = 0;
+    sum += ApplyLightCurvef(curve, Lerpf(fromf.r, tof.r, alpha));
+    sum += ApplyLightCurvef(curve, Lerpf(fromf.g, tof.g, alpha));
+    sum += ApplyLightCurvef(curve, Lerpf(fromf.b, tof.b, alpha));
+    sum += ApplyLightCurvef(curve, Lerpf(fromf.w, tof.w, alpha));
+    s_sink_f = sum;
+  });
+  Timing tx = Measure([&](int i) {
+    uint32_t alpha = (static_cast<uint64_t>(i) << 15) / kNumFrames;
+    float sum = 0;
+    sum += ApplyLightCurve(curve, LightLevelLerp(from.r, to.r, alpha)) *
+           (1.0f / kLightLevelMax);
+    sum += ApplyLightCurve(curve, LightLevelLerp(from.g, to.g, alpha)) *
+           (1.0f / kLightLevelMax);
+    sum += ApplyLightCurve(curve, LightLevelLerp(from.b, to.b, alpha)) *
+           (1.0f / kLightLevelMax);
+    sum += ApplyLightCurve(curve, LightLevelLerp(from.w, to.w, alpha)) *
+           (1.0f / kLightLevelMax);
+    s_sink_f = sum;
+  });
+  PrintTiming("frame float", tf);
+  PrintTiming("frame fixed", tx);
+
+  Timing hf = Measure([&](int i) {
+    RGBWf x = HSVToRGBWf(i % 360, i % 101, 100 - i % 101, true);
+    s_sink_f = x.r + x.g + x.b + x.w;
+  });
+  Timing hx = Measure([&](int i) {
+    RGBW x = HSVToRGBW(i % 360, i % 101, 100 - i % 101, true);
+    s_sink_l = x.r + x.g + x.b + x.w;
+  });
+  PrintTiming("hsv float", hf);
+  PrintTiming("hsv fixed", hx);
+}
+
+}  // namespace
+
+int main() {
+  bool ok = CheckHSV();
+  ok = CheckLerp() && ok;
+  ok = CheckCurve(LightCurve::kLinear, "linear") && ok;
+  ok = CheckCurve(LightCurve::kGamma, "gamma") && ok;
+  ok = CheckCurve(LightCurve::kCIE1931, "cie1931") && ok;
+  Bench();
+  return (ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
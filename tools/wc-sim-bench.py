@@ -0,0 +1,173 @@
+#!/usr/bin/env python3
+"""
+Copyright (c) 2021 Shelly-HomeKit Contributors
+All rights reserved
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+Window covering simulation benchmark.
+
+Drives a host build of the ShellyU25 firmware (make ShellyU25 PLATFORM=ubuntu)
+whose outputs are connected to a simulated shutter motor (src/mock).
+The motor is configured with short travel times so that a full session of
+calibration, partial moves and stops completes in a couple of minutes.
+
+Reports position error (simulated motor vs firmware estimate), reaction
+latency from target position change to output change and state machine
+wakeups per hour, both overall and while idle.
+Exits with non-zero status if any of the limits are exceeded.
+
+usage: wc-sim-bench.py [-h] [--host HOST] [--moves MOVES] [--stops STOPS]
+                       [--idle-time IDLE_TIME] [--seed SEED]
+                       [--max-pos-error MAX_POS_ERROR]
+                       [--max-latency-ms MAX_LATENCY_MS]
+                       [--max-idle-wakeups MAX_IDLE_WAKEUPS]
+"""
+
+import argparse
+import json
+import random
+import re
+import sys
+import time
+import urllib.request
+
+WC_TYPE = 4
+STATE_IDLE = 0
+STATE_CALIBRATE = 10
+
+
+class Device:
+  def __init__(self, host):
+    self.host = host
+
+  def call(self, method, **args):
+    req = urllib.request.Request(
+        f"http://{self.host}/rpc/{method}",
+        data=json.dumps(args).encode("utf-8"),
+        headers={"Content-Type": "application/json"})
+    with urllib.request.urlopen(req, timeout=10) as resp:
+      body = resp.read()
+      return json.loads(body) if body else None
+
+  def wc(self):
+    info = self.call("Shelly.GetInfoExt")
+    for c in info["components"]:
+      if c["type"] == WC_TYPE:
+        return c
+    return None
+
+  def stats(self):
+    res = self.call("Shelly.Mock.GetMotorStats")
+    wc_info = res["wc_info"]
+    res["cur_pos"] = float(re.search(r"cp:([-\d.]+)", wc_info).group(1))
+    res["num_runs"] = int(re.search(r"nr:(\d+)", wc_info).group(1))
+    return res
+
+  def wait_idle(self, timeout=120):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+      wc = self.wc()
+      if wc is not None and wc["state"] == STATE_IDLE:
+        return wc
+      time.sleep(0.2)
+    raise RuntimeError("timed out waiting for WC to become idle")
+
+
+def setup(dev, args):
+  info = dev.call("Shelly.GetInfoExt")
+  if info.get("sys_mode") != 1:
+    print("Switching to roller shutter mode, waiting for restart")
+    dev.call("Shelly.SetConfig", config={"sys_mode": 1})
+    time.sleep(5)
+  dev.call("Shelly.Mock.SetMotor", open_time_ms=args.open_time_ms,
+           close_time_ms=args.close_time_ms,
+           ramp_up_time_ms=args.ramp_up_time_ms, power=args.power,
+           pos=random.uniform(0, 100), obst_pos=-1)
+  print("Calibrating...")
+  dev.call("Shelly.SetState", id=1, type=WC_TYPE,
+           state={"state": STATE_CALIBRATE})
+  time.sleep(1)
+  wc = dev.wait_idle(timeout=(args.open_time_ms + args.close_time_ms) * 3)
+  if not wc["cal_done"]:
+    raise RuntimeError("calibration failed")
+  print(f"Calibrated: open {wc['open_time_ms']} close {wc['close_time_ms']} "
+        f"ramp {wc['ramp_up_time_ms']}")
+  dev.wait_idle()
+
+
+def run(dev, args):
+  errors = []
+  t0, s0 = time.time(), dev.stats()
+  for i in range(args.moves + args.stops):
+    tgt = random.randint(0, 100)
+    dev.call("Shelly.Mock.MoveWC", id=1, pos=tgt)
+    if i >= args.moves:
+      # Interrupt the move half way.
+      time.sleep(random.uniform(0.5, 2))
+      dev.call("Shelly.SetState", id=1, type=WC_TYPE, state={"tgt_pos": -1})
+    time.sleep(0.2)
+    dev.wait_idle()
+    st = dev.stats()
+    err = st["cur_pos"] - st["motor"]["pos"]
+    errors.append(abs(err))
+    print(f"{i:3d}: tgt {tgt:3d} est {st['cur_pos']:7.2f} "
+          f"actual {st['motor']['pos']:7.2f} err {err:+.2f}")
+  t1, s1 = time.time(), dev.stats()
+  print(f"Idle for {args.idle_time} s...")
+  time.sleep(args.idle_time)
+  t2, s2 = time.time(), dev.stats()
+  m = s1["motor"]
+  return {
+      "max_pos_error": max(errors),
+      "avg_pos_error": sum(errors) / len(errors),
+      "final_pos_error": errors[-1],
+      "avg_latency_ms": m["react_avg_ms"],
+      "max_latency_ms": m["react_max_ms"],
+      "wakeups_per_hour": (s1["num_runs"] - s0["num_runs"]) * 3600 / (t1 - t0),
+      "idle_wakeups_per_hour":
+          (s2["num_runs"] - s1["num_runs"]) * 3600 / (t2 - t1),
+  }
+
+
+def main():
+  parser = argparse.ArgumentParser(description="WC simulation benchmark")
+  parser.add_argument("--host", default="localhost:8080")
+  parser.add_argument("--moves", type=int, default=20)
+  parser.add_argument("--stops", type=int, default=5)
+  parser.add_argument("--idle-time", type=int, default=30)
+  parser.add_argument("--seed", type=int, default=1)
+  parser.add_argument("--open-time-ms", type=int, default=6000)
+  parser.add_argument("--close-time-ms", type=int, default=5000)
+  parser.add_argument("--ramp-up-time-ms", type=int, default=300)
+  parser.add_argument("--power", type=float, default=100)
+  parser.add_argument("--max-pos-error", type=float, default=1.0)
+  parser.add_argument("--max-latency-ms", type=float, default=50)
+  parser.add_argument("--max-idle-wakeups", type=float, default=0)
+  args = parser.parse_args()
+  random.seed(args.seed)
+
+  dev = Device(args.host)
+  setup(dev, args)
+  res = run(dev, args)
+  print(json.dumps(res, indent=2))
+
+  ok = (res["max_pos_error"] <= args.max_pos_error and
+        res["max_latency_ms"] <= args.max_latency_ms and
+        res["idle_wakeups_per_hour"] <= args.max_idle_wakeups)
+  print("PASS" if ok else "FAIL")
+  return 0 if ok else 1
+
+
+if __name__ == "__main__":
+  sys.exit(main())